@@ -0,0 +1,36 @@
+#include "arena.h"
+
+Arena::Arena(size_t blockSize_): blockSize(blockSize_ > 0 ? blockSize_ : DefaultBlockSize) {}
+
+void *Arena::allocateSlow(size_t size, size_t align){
+    size_t need = size + align;
+    // move on to the next free block that is big enough, or add one
+    size_t next = ptr ? current + 1 : current;
+    size_t k = next;
+    while(k < blocks.size() && blocks[k].size < need) k++;
+    if(k == blocks.size()){
+        size_t n = need > blockSize ? need : blockSize;
+        blocks.push_back(Block{std::unique_ptr<char[]>(new char[n]), n});
+    }
+    std::swap(blocks[next], blocks[k]);
+    current = next;
+    ptr = blocks[current].data.get();
+    end = ptr + blocks[current].size;
+    return allocate(size, align);
+}
+
+void Arena::reset(){
+    size_t kept = 0, k = 0;
+    while(k < blocks.size() && kept + blocks[k].size <= maxRetained) kept += blocks[k++].size;
+    blocks.resize(k);
+    current = 0;
+    ptr = blocks.empty() ? nullptr : blocks[0].data.get();
+    end = blocks.empty() ? nullptr : ptr + blocks[0].size;
+    allocated = 0;
+}
+
+size_t Arena::capacity() const {
+    size_t n = 0;
+    for(auto &b : blocks) n += b.size;
+    return n;
+}
@@ -0,0 +1,54 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Bump allocator for AST nodes. Nothing is freed individually: reset()
+// releases everything at once and keeps the blocks for the next compile,
+// so only trivially destructible types may be allocated here.
+class Arena {
+public:
+    static const size_t DefaultBlockSize = 1u << 20;
+    explicit Arena(size_t blockSize = DefaultBlockSize);
+    Arena(const Arena &) = delete;
+    Arena &operator=(const Arena &) = delete;
+
+    template<class T, class... Args>
+    T *make(Args&&... args){
+        static_assert(std::is_trivially_destructible<T>::value, "arena objects are never destroyed");
+        return new(allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    }
+
+    void *allocate(size_t size, size_t align){
+        uintptr_t p = ((uintptr_t)ptr + align - 1) & ~(uintptr_t)(align - 1);
+        if(ptr && p + size <= (uintptr_t)end){
+            ptr = (char*)(p + size);
+            allocated += size;
+            return (void*)p;
+        }
+        return allocateSlow(size, align);
+    }
+
+    // Makes all memory reusable. Blocks past maxRetained bytes are freed, so
+    // one huge input does not pin its memory for the life of the arena.
+    void reset();
+    size_t used() const { return allocated; } // bytes handed out since reset()
+    size_t capacity() const;                  // bytes held in blocks
+
+    size_t maxRetained = 64u << 20;
+private:
+    struct Block {
+        std::unique_ptr<char[]> data;
+        size_t size;
+    };
+    std::vector<Block> blocks;
+    size_t blockSize;
+    size_t current = 0; // blocks[current] is being filled, later ones are free
+    char *ptr = nullptr, *end = nullptr;
+    size_t allocated = 0;
+    void *allocateSlow(size_t size, size_t align);
+};
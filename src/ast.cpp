@@ -0,0 +1,28 @@
+#include "ast.h"
+#include "error.h"
+#include <algorithm>
+#include <unordered_map>
+
+void resolveLocals(Function &f, const std::vector<DeclStmt*> &decls, const std::vector<VarExpr*> &uses){
+    // declarations anywhere in the body are visible in the whole function
+    f.locals.clear();
+    for(DeclStmt *ds : decls) f.locals.push_back(ds->name);
+    std::sort(f.locals.begin(), f.locals.end());
+    f.locals.erase(std::unique(f.locals.begin(), f.locals.end()), f.locals.end());
+    std::unordered_map<std::string_view, int> slots;
+    for(size_t k = 0; k < f.locals.size(); k++) slots.emplace(f.locals[k], (int)k);
+
+    for(DeclStmt *ds : decls) ds->slot = slots.at(ds->name);
+    // runs of uses of the same name are common; only look up a new one
+    std::string_view last;
+    int lastSlot = -1;
+    for(VarExpr *v : uses){
+        if(lastSlot < 0 || v->name != last){
+            auto it = slots.find(v->name);
+            if(it == slots.end()) throw CompileError(0, "Undefined variable " + std::string(v->name));
+            last = v->name;
+            lastSlot = it->second;
+        }
+        v->slot = lastSlot;
+    }
+}
@@ -1,77 +1,200 @@
 #pragma once
 #include <string>
+#include <string_view>
 #include <vector>
-#include <memory>
-#include <map>
+#include <cstdint>
 
-struct Node {
-    virtual ~Node() = default;
+// AST nodes live in an Arena (see arena.h) and are never destroyed one by
+// one, so they hold only plain data: child pointers into the same arena and
+// names as views of the source text. A tree is only valid while both the
+// arena and the source are.
+
+// Every node records its concrete type, so passes switch on kind and
+// static_cast instead of trying dynamic_cast on each candidate.
+enum class NodeKind : uint8_t {
+    Integer, Var, Binary,
+    Decl, ExprStmt, Return, If, While, Block,
 };
 
-using NodePtr = std::unique_ptr<Node>;
+enum class BinOp : uint8_t {
+    Assign, Or, And, Eq, Ne, Lt, Le, Gt, Ge, Add, Sub, Mul, Div, Mod,
+    Neg, // unary minus, stored as 0 - operand with a dummy 0 on the left
+};
 
-struct Expr : Node {
-    virtual ~Expr() = default;
+struct Node {
+    const NodeKind kind;
+    explicit Node(NodeKind k): kind(k) {}
 };
 
+// Statements also link to the next one in their block. Expressions, the
+// bulk of the nodes, carry no link, and small fields of a node pack into
+// the padding after kind.
 struct Stmt : Node {
-    virtual ~Stmt() = default;
+    Stmt *next = nullptr; // following statement in the enclosing block
+    explicit Stmt(NodeKind k): Node(k) {}
 };
 
-struct Integer : Expr {
+struct Integer : Node {
     int value;
-    Integer(int v): value(v) {}
+    Integer(int v): Node(NodeKind::Integer), value(v) {}
 };
 
-struct VarExpr : Expr {
-    std::string name;
-    VarExpr(std::string n): name(std::move(n)) {}
+struct VarExpr : Node {
+    int slot = -1; // index of the local, set by resolveLocals
+    std::string_view name;
+    VarExpr(std::string_view n): Node(NodeKind::Var), name(n) {}
 };
 
-struct Binary : Expr {
-    std::string op;
-    NodePtr lhs, rhs;
-    Binary(std::string op_, NodePtr l, NodePtr r): op(op_), lhs(std::move(l)), rhs(std::move(r)) {}
+struct Binary : Node {
+    BinOp op;
+    Node *lhs, *rhs;
+    Binary(BinOp op_, Node *l, Node *r): Node(NodeKind::Binary), op(op_), lhs(l), rhs(r) {}
 };
 
 struct DeclStmt : Stmt {
-    std::string name;
-    NodePtr init; // may be null
-    DeclStmt(std::string n, NodePtr i): name(std::move(n)), init(std::move(i)) {}
+    std::string_view name;
+    Node *init; // may be null
+    int slot = -1; // set by resolveLocals
+    DeclStmt(std::string_view n, Node *i): Stmt(NodeKind::Decl), name(n), init(i) {}
 };
 
 struct ExprStmt : Stmt {
-    NodePtr expr;
-    ExprStmt(NodePtr e): expr(std::move(e)) {}
+    Node *expr;
+    ExprStmt(Node *e): Stmt(NodeKind::ExprStmt), expr(e) {}
 };
 
 struct ReturnStmt : Stmt {
-    NodePtr expr;
-    ReturnStmt(NodePtr e): expr(std::move(e)) {}
+    Node *expr;
+    ReturnStmt(Node *e): Stmt(NodeKind::Return), expr(e) {}
 };
 
 struct IfStmt : Stmt {
-    NodePtr cond;
-    NodePtr thenStmt;
-    NodePtr elseStmt; // may be null
-    IfStmt(NodePtr c, NodePtr t, NodePtr e): cond(std::move(c)), thenStmt(std::move(t)), elseStmt(std::move(e)) {}
+    Node *cond;
+    Stmt *thenStmt;
+    Stmt *elseStmt; // may be null
+    IfStmt(Node *c, Stmt *t, Stmt *e): Stmt(NodeKind::If), cond(c), thenStmt(t), elseStmt(e) {}
 };
 
 struct WhileStmt : Stmt {
-    NodePtr cond;
-    NodePtr body;
-    WhileStmt(NodePtr c, NodePtr b): cond(std::move(c)), body(std::move(b)) {}
+    Node *cond;
+    Stmt *body;
+    WhileStmt(Node *c, Stmt *b): Stmt(NodeKind::While), cond(c), body(b) {}
 };
 
 struct BlockStmt : Stmt {
-    std::vector<NodePtr> stmts;
+    Stmt *first = nullptr, *last = nullptr; // linked through next
+    BlockStmt(): Stmt(NodeKind::Block) {}
+    void append(Stmt *s){
+        if(last) last->next = s; else first = s;
+        last = s;
+    }
 };
 
 struct Function {
     std::string name;
-    std::vector<NodePtr> body; // list of Stmt
+    BlockStmt *body = nullptr;
+    // Source span of the whole function, used as the code cache key. Only
+    // valid while the source buffer passed to compile() is alive;
+    // tinycc.cpp clears the token view before returning.
+    std::string_view text;
+    // Distinct locals in name order: VarExpr::slot and DeclStmt::slot index
+    // this. Filled by resolveLocals.
+    std::vector<std::string_view> locals;
 };
 
 struct Program {
     std::vector<Function> funcs;
 };
+
+// Gives every local of f a slot and points each variable use at it, so the
+// backends never look names up. decls and uses must hold every declaration
+// and variable in f's body; the parser records them as it builds the tree.
+// Throws CompileError for an undeclared name.
+void resolveLocals(Function &f, const std::vector<DeclStmt*> &decls, const std::vector<VarExpr*> &uses);
+
+// What an If or While hands from its first hook to the later ones: the
+// labels or instructions still to be placed or patched.
+struct StmtMarks {
+    int a = 0, b = 0;
+};
+
+// Walks the statements under a root in source order for the backends. It
+// keeps its own stack instead of recursing, so arbitrarily deep nesting
+// cannot overflow the native stack, and the stack is kept between walks so
+// it stops allocating. V is called back as
+//     simple(Stmt*)                       a Decl, ExprStmt or Return
+//     ifBegin(IfStmt*, StmtMarks&)        before the then branch
+//     ifElse(IfStmt*, StmtMarks&)         between the branches, if there is an else
+//     ifEnd(IfStmt*, StmtMarks&)
+//     whileBegin(WhileStmt*, StmtMarks&)  before the body
+//     whileEnd(WhileStmt*, StmtMarks&)
+class StmtWalker {
+public:
+    template<class V> void walk(Stmt *root, V &v);
+private:
+    struct Item {
+        Stmt *n;
+        int state; // how far n has got
+        StmtMarks marks;
+        Stmt *next; // Block: the statement being walked
+    };
+    std::vector<Item> stack;
+};
+
+template<class V>
+void StmtWalker::walk(Stmt *root, V &v){
+    stack.clear();
+    stack.push_back(Item{root, 0, StmtMarks{}, nullptr});
+    while(!stack.empty()){
+        // w is only used before anything is pushed
+        Item &w = stack.back();
+        Stmt *n = w.n;
+        switch(n->kind){
+        case NodeKind::If: {
+            auto *ifs = static_cast<IfStmt*>(n);
+            Stmt *branch = nullptr;
+            if(w.state == 0){
+                v.ifBegin(ifs, w.marks);
+                branch = ifs->thenStmt;
+            } else if(w.state == 1 && ifs->elseStmt){
+                v.ifElse(ifs, w.marks);
+                branch = ifs->elseStmt;
+            } else {
+                v.ifEnd(ifs, w.marks);
+            }
+            w.state++;
+            if(branch) stack.push_back(Item{branch, 0, StmtMarks{}, nullptr});
+            else stack.pop_back();
+            break;
+        }
+        case NodeKind::While: {
+            auto *ws = static_cast<WhileStmt*>(n);
+            if(w.state == 0){
+                v.whileBegin(ws, w.marks);
+                w.state = 1;
+                stack.push_back(Item{ws->body, 0, StmtMarks{}, nullptr});
+            } else {
+                v.whileEnd(ws, w.marks);
+                stack.pop_back();
+            }
+            break;
+        }
+        case NodeKind::Block: {
+            auto *bs = static_cast<BlockStmt*>(n);
+            Stmt *next = w.state == 0 ? bs->first : w.next->next;
+            w.state = 1;
+            if(next){
+                w.next = next;
+                stack.push_back(Item{next, 0, StmtMarks{}, nullptr});
+            } else {
+                stack.pop_back();
+            }
+            break;
+        }
+        default:
+            v.simple(n);
+            stack.pop_back();
+            break;
+        }
+    }
+}
@@ -0,0 +1,273 @@
+#include "bytecode.h"
+#include <climits>
+#include <stdexcept>
+#include <string>
+
+const BytecodeFunction *BytecodeProgram::find(const std::string &name) const {
+    for(auto &f : funcs) if(f.name == name) return &f;
+    return nullptr;
+}
+
+BytecodeGen::BytecodeGen(const Program &p): prog(p) {}
+
+BytecodeProgram BytecodeGen::generate(){
+    BytecodeProgram out;
+    out.funcs.reserve(prog.funcs.size());
+    for(auto &f : prog.funcs){
+        out.funcs.emplace_back();
+        cur = &out.funcs.back();
+        genFunction(f);
+    }
+    return out;
+}
+
+int BytecodeGen::emit(Op op, int a, int b, int c){
+    cur->code.push_back(Insn{op, a, b, c});
+    return (int)cur->code.size() - 1;
+}
+
+int BytecodeGen::here() const {
+    return (int)cur->code.size();
+}
+
+int BytecodeGen::newTemp(){
+    int r = nextTemp++;
+    if(nextTemp > cur->numRegs) cur->numRegs = nextTemp;
+    return r;
+}
+
+static bool isLeaf(Node *n){
+    return n->kind == NodeKind::Integer || n->kind == NodeKind::Var;
+}
+
+void BytecodeGen::genFunction(const Function &f){
+    cur->name = f.name;
+    // one register per local, in resolveLocals' slot order
+    numLocals = (int)f.locals.size();
+    nextTemp = numLocals;
+    cur->numRegs = numLocals;
+
+    genStmt(f.body);
+    // default return 0 if no explicit return
+    nextTemp = numLocals;
+    int r = newTemp();
+    emit(Op::LoadK, r, 0);
+    emit(Op::Ret, r);
+}
+
+// What BytecodeGen emits at each point of the statement walk
+struct BytecodeGen::StmtEmitter {
+    BytecodeGen &g;
+
+    void simple(Stmt *n){
+        if(n->kind == NodeKind::Decl){
+            auto *ds = static_cast<DeclStmt*>(n);
+            if(ds->init){
+                int r = g.genExpr(ds->init);
+                // a temporary result was written by the last instruction;
+                // let that write the local directly
+                if(r >= g.numLocals) g.cur->code.back().a = ds->slot;
+                else g.emit(Op::Mov, ds->slot, r);
+            } else {
+                g.emit(Op::LoadK, ds->slot, 0);
+            }
+        } else if(n->kind == NodeKind::ExprStmt){
+            g.genExpr(static_cast<ExprStmt*>(n)->expr);
+        } else if(n->kind == NodeKind::Return){
+            g.emit(Op::Ret, g.genExpr(static_cast<ReturnStmt*>(n)->expr));
+        }
+    }
+    // m.a = the jump still to be pointed past the branch
+    void ifBegin(IfStmt *ifs, StmtMarks &m){
+        m.a = g.emit(Op::Jz, g.genExpr(ifs->cond), -1);
+    }
+    void ifElse(IfStmt *, StmtMarks &m){
+        int jmp = g.emit(Op::Jmp, -1);
+        g.cur->code[m.a].b = g.here();
+        m.a = jmp;
+    }
+    void ifEnd(IfStmt *, StmtMarks &m){
+        Insn &j = g.cur->code[m.a];
+        (j.op == Op::Jz ? j.b : j.a) = g.here();
+    }
+    // m.a = the exit jump, m.b = loop top
+    void whileBegin(WhileStmt *ws, StmtMarks &m){
+        m.b = g.here();
+        m.a = g.emit(Op::Jz, g.genExpr(ws->cond), -1);
+    }
+    void whileEnd(WhileStmt *, StmtMarks &m){
+        g.emit(Op::Loop, m.b);
+        g.cur->code[m.a].b = g.here();
+    }
+};
+
+void BytecodeGen::genStmt(Stmt *root){
+    StmtEmitter e{*this};
+    stmts.walk(root, e);
+}
+
+static Op binaryOpcode(BinOp op){
+    switch(op){
+        case BinOp::Add: return Op::Add;
+        case BinOp::Sub: return Op::Sub;
+        case BinOp::Mul: return Op::Mul;
+        case BinOp::Div: return Op::Div;
+        case BinOp::Mod: return Op::Mod;
+        case BinOp::Eq: return Op::Eq;
+        case BinOp::Ne: return Op::Ne;
+        case BinOp::Lt: return Op::Lt;
+        case BinOp::Le: return Op::Le;
+        case BinOp::Gt: return Op::Gt;
+        case BinOp::Ge: return Op::Ge;
+        case BinOp::And: return Op::LAnd;
+        case BinOp::Or: return Op::LOr;
+        default: throw std::runtime_error("Unknown binary op in bytecode");
+    }
+}
+
+// Locals are used in place as operands; every other value goes into the
+// next free temporary, and a node's temporaries are released once it has
+// produced its result. Like CodeGen's, the walk uses an explicit stack.
+int BytecodeGen::genExpr(Node *root){
+    auto &st = exprWork;
+    auto &vals = exprVals;
+    st.clear();
+    vals.clear();
+    nextTemp = numLocals; // temporaries never live across statements
+    st.push_back(ExprWork{root, 0, nextTemp});
+    while(!st.empty()){
+        ExprWork &w = st.back();
+        Node *n = w.n;
+        if(n->kind == NodeKind::Integer){
+            int r = newTemp();
+            emit(Op::LoadK, r, static_cast<Integer*>(n)->value);
+            vals.push_back(r);
+            st.pop_back();
+            continue;
+        }
+        if(n->kind == NodeKind::Var){
+            vals.push_back(static_cast<VarExpr*>(n)->slot);
+            st.pop_back();
+            continue;
+        }
+        if(n->kind != NodeKind::Binary) throw std::runtime_error("Unknown expr node in bytecode");
+        auto *bin = static_cast<Binary*>(n);
+        if(bin->op == BinOp::Assign || bin->op == BinOp::Neg){
+            // only the right operand is evaluated (Neg is 0 - rhs)
+            if(w.state == 0){
+                w.state = 1;
+                st.push_back(ExprWork{bin->rhs, 0, nextTemp});
+                continue;
+            }
+            int r = vals.back();
+            vals.pop_back();
+            int base = w.base;
+            BinOp op = bin->op;
+            st.pop_back();
+            if(op == BinOp::Neg){
+                nextTemp = base;
+                int d = newTemp();
+                emit(Op::Neg, d, r);
+                vals.push_back(d);
+                continue;
+            }
+            // the parser only accepts a variable on the left
+            int slot = static_cast<VarExpr*>(bin->lhs)->slot;
+            if(r >= numLocals) cur->code.back().a = slot; // as for declarations
+            else emit(Op::Mov, slot, r);
+            nextTemp = base;
+            vals.push_back(slot);
+            continue;
+        }
+        if(w.state == 0){
+            w.state = 1;
+            st.push_back(ExprWork{bin->lhs, 0, nextTemp});
+            continue;
+        }
+        if(w.state == 1){
+            // the native code saves the left value before evaluating the
+            // right; do the same when the right side might assign to it
+            if(vals.back() < numLocals && !isLeaf(bin->rhs)){
+                int t = newTemp();
+                emit(Op::Mov, t, vals.back());
+                vals.back() = t;
+            }
+            w.state = 2;
+            st.push_back(ExprWork{bin->rhs, 0, nextTemp});
+            continue;
+        }
+        int rhs = vals.back(); vals.pop_back();
+        int lhs = vals.back(); vals.pop_back();
+        nextTemp = w.base;
+        int d = newTemp();
+        emit(binaryOpcode(bin->op), d, lhs, rhs);
+        vals.push_back(d);
+        st.pop_back();
+    }
+    return vals.back();
+}
+
+static void trapDivision(int32_t lhs, int32_t rhs){
+    if(rhs == 0) throw std::runtime_error("Division by zero");
+    if(rhs == -1 && lhs == INT32_MIN) throw std::runtime_error("Integer overflow in division");
+}
+
+[[noreturn]] static void trapSteps(uint64_t maxSteps){
+    throw std::runtime_error("Step limit exceeded (" + std::to_string(maxSteps) + " instructions)");
+}
+
+// Dispatch is threaded through a table of label addresses (computed goto)
+// where the compiler supports it, with a plain switch loop otherwise.
+int runBytecode(const BytecodeFunction &f, uint64_t &steps, uint64_t maxSteps){
+    std::vector<int32_t> regs(f.numRegs > 0 ? f.numRegs : 1, 0);
+    int32_t *r = regs.data();
+    const Insn *code = f.code.data();
+    const Insn *pc = code;
+    uint64_t n = 0;
+#define WRAP(expr) (int32_t)(expr)
+#define U(x) ((uint32_t)(x))
+#if defined(__GNUC__)
+    static void *const labels[] = {
+        &&L_LoadK, &&L_Mov, &&L_Add, &&L_Sub, &&L_Mul, &&L_Div, &&L_Mod,
+        &&L_Eq, &&L_Ne, &&L_Lt, &&L_Le, &&L_Gt, &&L_Ge, &&L_LAnd, &&L_LOr,
+        &&L_Neg, &&L_Jz, &&L_Jmp, &&L_Ret, &&L_Loop,
+    };
+    static_assert(sizeof(labels) / sizeof(labels[0]) == (size_t)Op::Count, "one label per opcode");
+#define VM_CASE(o) L_##o:
+#define VM_DISPATCH() do { n++; goto *labels[(int)pc->op]; } while(0)
+    VM_DISPATCH();
+#else
+#define VM_CASE(o) case Op::o:
+#define VM_DISPATCH() continue
+    for(n = 1;; n++) switch(pc->op){
+#endif
+    VM_CASE(LoadK) r[pc->a] = pc->b; pc++; VM_DISPATCH();
+    VM_CASE(Mov) r[pc->a] = r[pc->b]; pc++; VM_DISPATCH();
+    VM_CASE(Add) r[pc->a] = WRAP(U(r[pc->b]) + U(r[pc->c])); pc++; VM_DISPATCH();
+    VM_CASE(Sub) r[pc->a] = WRAP(U(r[pc->b]) - U(r[pc->c])); pc++; VM_DISPATCH();
+    VM_CASE(Mul) r[pc->a] = WRAP(U(r[pc->b]) * U(r[pc->c])); pc++; VM_DISPATCH();
+    VM_CASE(Div) trapDivision(r[pc->b], r[pc->c]); r[pc->a] = r[pc->b] / r[pc->c]; pc++; VM_DISPATCH();
+    VM_CASE(Mod) trapDivision(r[pc->b], r[pc->c]); r[pc->a] = r[pc->b] % r[pc->c]; pc++; VM_DISPATCH();
+    VM_CASE(Eq) r[pc->a] = r[pc->b] == r[pc->c]; pc++; VM_DISPATCH();
+    VM_CASE(Ne) r[pc->a] = r[pc->b] != r[pc->c]; pc++; VM_DISPATCH();
+    VM_CASE(Lt) r[pc->a] = r[pc->b] < r[pc->c]; pc++; VM_DISPATCH();
+    VM_CASE(Le) r[pc->a] = r[pc->b] <= r[pc->c]; pc++; VM_DISPATCH();
+    VM_CASE(Gt) r[pc->a] = r[pc->b] > r[pc->c]; pc++; VM_DISPATCH();
+    VM_CASE(Ge) r[pc->a] = r[pc->b] >= r[pc->c]; pc++; VM_DISPATCH();
+    VM_CASE(LAnd) r[pc->a] = r[pc->b] != 0 && r[pc->c] != 0; pc++; VM_DISPATCH();
+    VM_CASE(LOr) r[pc->a] = r[pc->b] != 0 || r[pc->c] != 0; pc++; VM_DISPATCH();
+    VM_CASE(Neg) r[pc->a] = WRAP(0u - U(r[pc->b])); pc++; VM_DISPATCH();
+    VM_CASE(Jz) pc = r[pc->a] == 0 ? code + pc->b : pc + 1; VM_DISPATCH();
+    VM_CASE(Jmp) pc = code + pc->a; VM_DISPATCH();
+    VM_CASE(Ret) steps = n; return r[pc->a];
+    // only loops jump backwards, so checking the budget there bounds the run
+    VM_CASE(Loop) if(n > maxSteps) trapSteps(maxSteps); pc = code + pc->a; VM_DISPATCH();
+#if !defined(__GNUC__)
+    default: throw std::runtime_error("Invalid opcode");
+    }
+#endif
+#undef VM_CASE
+#undef VM_DISPATCH
+#undef WRAP
+#undef U
+}
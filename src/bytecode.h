@@ -0,0 +1,69 @@
+#pragma once
+#include "ast.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Register-based bytecode backend. Each function gets a flat register file:
+// its locals first, then expression temporaries. Semantics follow CodeGen
+// exactly (32-bit wrapping ints, both sides of && and || evaluated, operands
+// left to right), so the interpreter can serve as a reference for the x86
+// output.
+
+enum class Op : uint8_t {
+    LoadK,  // r[a] = b
+    Mov,    // r[a] = r[b]
+    Add, Sub, Mul, Div, Mod,   // r[a] = r[b] op r[c]
+    Eq, Ne, Lt, Le, Gt, Ge,    // r[a] = r[b] op r[c] ? 1 : 0
+    LAnd, LOr,                 // r[a] = r[b] && / || r[c]
+    Neg,    // r[a] = -r[b]
+    Jz,     // if r[a] == 0 goto b
+    Jmp,    // goto a
+    Ret,    // return r[a]
+    Loop,   // goto a, backwards: a loop's back edge, checked against the step budget
+    Count,  // number of opcodes, not an instruction
+};
+
+struct Insn {
+    Op op;
+    int32_t a, b, c;
+};
+
+struct BytecodeFunction {
+    std::string name;
+    int numRegs = 0;
+    std::vector<Insn> code;
+};
+
+struct BytecodeProgram {
+    std::vector<BytecodeFunction> funcs;
+    const BytecodeFunction *find(const std::string &name) const;
+};
+
+class BytecodeGen {
+public:
+    BytecodeGen(const Program &p);
+    BytecodeProgram generate();
+private:
+    const Program &prog;
+    BytecodeFunction *cur = nullptr;
+    int numLocals = 0; // registers 0..numLocals-1 hold the locals by slot
+    int nextTemp = 0;
+    void genFunction(const Function &f);
+    void genStmt(Stmt *n);
+    int genExpr(Node *n); // returns the register holding the value
+    int emit(Op op, int a, int b = 0, int c = 0); // returns the index of the instruction
+    int here() const; // index of the next instruction
+    int newTemp();
+    struct StmtEmitter; // genStmt's hooks for StmtWalker
+    StmtWalker stmts;
+    struct ExprWork { Node *n; int state; int base; }; // base: first temporary of n
+    std::vector<ExprWork> exprWork;
+    std::vector<int> exprVals; // result registers of finished subexpressions
+};
+
+// Runs f with a fresh register file and returns its result. steps receives
+// the number of instructions executed. Throws std::runtime_error where the
+// native code would trap (division by zero or INT_MIN / -1), and once a
+// loop jumps back after more than maxSteps instructions.
+int runBytecode(const BytecodeFunction &f, uint64_t &steps, uint64_t maxSteps = UINT64_MAX);
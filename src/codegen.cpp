@@ -1,239 +1,257 @@
 #include "codegen.h"
 #include "ast.h"
-#include <sstream>
-#include <iostream>
+#include "error.h"
+#include <vector>
 
-CodeGen::CodeGen(const Program &p): prog(p) {}
+CodeGen::CodeGen(const Program &p, FunctionCache *cache_): prog(p), cache(cache_) {}
 
-std::string CodeGen::emitLabel(){
-    return ".L" + std::to_string(labelCounter++);
+// labels are numbered per function (.L<func>.<n>) so that a function's code
+// does not depend on what precedes it
+int CodeGen::emitLabel(){
+    return labelCounter++;
 }
 
-void CodeGen::assignStackOffsets(const Function &f, std::map<std::string,int> &offsets, int &frameSize){
-    // find declared vars in function body (very simple scan)
-    int offset = 0;
-    int localCount = 0;
-    // scan statements recursively (only top-level decls considered here)
-    std::function<void(Node*)> scan = [&](Node* n){
-        if(!n) return;
-        if(auto *ds = dynamic_cast<DeclStmt*>(n)){
-            localCount++;
-            offsets[ds->name] = 0; // placeholder
-        } else if(auto *bs = dynamic_cast<BlockStmt*>(n)){
-            for(auto &s : bs->stmts) scan(s.get());
-        } else if(auto *ifs = dynamic_cast<IfStmt*>(n)){
-            scan(ifs->thenStmt.get());
-            scan(ifs->elseStmt.get());
-        } else if(auto *ws = dynamic_cast<WhileStmt*>(n)){
-            scan(ws->body.get());
-        }
-    };
-    for(auto &s : f.body) scan(s.get());
-    // assign 4 bytes per local (int)
-    frameSize = ((localCount * 4) + 15) / 16 * 16; // align to 16
-    int curOffset = 0;
-    for(auto &kv : offsets){
-        curOffset += 4;
-        kv.second = -curOffset; // rbp - offset
-    }
+// appends "<prefix>.L<func>.<label><suffix>"
+void CodeGen::appendLabel(AsmOut &out, std::string_view prefix, int label, std::string_view suffix){
+    out << prefix << ".L" << curFunc->name << '.' << label << suffix;
 }
 
 std::string CodeGen::generate(){
-    std::ostringstream out;
+    // the assembly runs to about 10 bytes per source byte; starting with
+    // that much saves copying it as it grows
+    size_t sourceBytes = 0;
+    for(auto &f : prog.funcs) sourceBytes += f.text.size();
+    AsmOut out(sourceBytes * 10);
+    out << "    .intel_syntax noprefix\n";
     out << "    .text\n";
     for(auto &f : prog.funcs){
-        out << emitFunction(f);
+        if(!cache || cache->maxEntries == 0 || f.text.empty()){
+            emitFunction(f, out);
+            continue;
+        }
+        std::string key(f.text);
+        auto it = cache->entries.find(key);
+        if(it != cache->entries.end()){
+            cache->hits++;
+            out << it->second;
+            continue;
+        }
+        cache->misses++;
+        size_t start = out.size();
+        emitFunction(f, out);
+        size_t size = key.size() + (out.size() - start);
+        if(size > cache->maxBytes) continue;
+        if(cache->entries.size() >= cache->maxEntries || cache->bytes + size > cache->maxBytes){
+            cache->entries.clear();
+            cache->bytes = 0;
+        }
+        cache->bytes += size;
+        cache->entries.emplace(std::move(key), std::string(out.view(start)));
     }
-    return out.str();
+    return out.take();
 }
 
-std::string CodeGen::emitFunction(const Function &f){
-    std::ostringstream out;
-    out << "    .global " << f.name << "\n";
+void CodeGen::emitFunction(const Function &f, AsmOut &out){
+    curFunc = &f;
+    labelCounter = 0;
+    out << "    .global " << f.name << '\n';
     out << f.name << ":\n";
     out << "    push rbp\n";
     out << "    mov rbp, rsp\n";
-    // compute locals
-    std::map<std::string,int> offsets;
-    int frameSize = 0;
-    assignStackOffsets(f, offsets, frameSize);
-    if(frameSize > 0) out << "    sub rsp, " << frameSize << "\n";
+    // 4 bytes per local (int), slot k at rbp - 4(k+1), frame aligned to 16
+    int frameSize = ((int)f.locals.size() * 4 + 15) / 16 * 16;
+    if(frameSize > 0) out << "    sub rsp, " << frameSize << '\n';
 
     // generate statements
-    for(auto &s : f.body){
-        out << genStmt(s.get(), offsets);
-    }
+    genStmt(f.body, out);
     // default return 0 if no explicit return
     out << "    mov eax, 0\n";
-    if(frameSize > 0) out << "    add rsp, " << frameSize << "\n";
+    // return statements jump here with their value in eax
+    out << ".L" << f.name << ".ret:\n";
+    if(frameSize > 0) out << "    add rsp, " << frameSize << '\n';
     out << "    pop rbp\n";
     out << "    ret\n\n";
-    return out.str();
 }
 
-std::string CodeGen::genStmt(Node *n, std::map<std::string,int> &offsets){
-    std::ostringstream out;
-    if(auto *ds = dynamic_cast<DeclStmt*>(n)){
-        if(ds->init){
-            out << genExpr(ds->init.get(), offsets);
-            // value in eax, store to local
-            int off = offsets[ds->name];
-            out << "    mov DWORD PTR [rbp" << off << "], eax\n";
-        } else {
-            // uninitialized -> zero
-            int off = offsets[ds->name];
-            out << "    mov DWORD PTR [rbp" << off << "], 0\n";
+// appends "<prefix>DWORD PTR [rbp-<offset of slot>]<suffix>"
+static void emitLocal(AsmOut &out, std::string_view prefix, int slot, std::string_view suffix){
+    out << prefix << "DWORD PTR [rbp" << -4 * (slot + 1) << ']' << suffix;
+}
+
+// What CodeGen emits at each point of the statement walk
+struct CodeGen::StmtEmitter {
+    CodeGen &cg;
+    AsmOut &out;
+
+    void simple(Stmt *n){
+        if(n->kind == NodeKind::Decl){
+            auto *ds = static_cast<DeclStmt*>(n);
+            if(ds->init){
+                cg.genExpr(ds->init, out);
+                // value in eax, store to local
+                emitLocal(out, "    mov ", ds->slot, ", eax\n");
+            } else {
+                // uninitialized -> zero
+                emitLocal(out, "    mov ", ds->slot, ", 0\n");
+            }
+        } else if(n->kind == NodeKind::ExprStmt){
+            cg.genExpr(static_cast<ExprStmt*>(n)->expr, out);
+        } else if(n->kind == NodeKind::Return){
+            cg.genExpr(static_cast<ReturnStmt*>(n)->expr, out);
+            // the value is in eax; leave through the function's epilogue
+            out << "    jmp .L" << cg.curFunc->name << ".ret\n";
         }
-        return out.str();
     }
-    if(auto *es = dynamic_cast<ExprStmt*>(n)){
-        out << genExpr(es->expr.get(), offsets);
-        return out.str();
+    // m.a = else label, m.b = end label
+    void ifBegin(IfStmt *ifs, StmtMarks &m){
+        m.a = cg.emitLabel();
+        m.b = cg.emitLabel();
+        cg.genExpr(ifs->cond, out);
+        out << "    cmp eax, 0\n";
+        cg.appendLabel(out, "    je ", m.a, "\n");
     }
-    if(auto *rs = dynamic_cast<ReturnStmt*>(n)){
-        out << genExpr(rs->expr.get(), offsets);
-        // result is in eax
-        // restore frame and ret
-        out << "    mov ebx, eax\n"; // move to ebx to keep
-        // epilogue
-        out << "    mov eax, ebx\n";
-        out << "    jmp .LRETURN\n"; // We'll patch: easier: inline epilogue here (avoid label complexity)
-        // Instead of jmp, generate epilogue:
-        // BUT we need frameSize; not available here -- small compromise: caller ensures frame is 0 or we can reconstruct
+    void ifElse(IfStmt *, StmtMarks &m){
+        cg.appendLabel(out, "    jmp ", m.b, "\n");
+        cg.appendLabel(out, "", m.a, ":\n");
     }
-    if(auto *ifs = dynamic_cast<IfStmt*>(n)){
-        std::string Lelse = emitLabel();
-        std::string Lend = emitLabel();
-        out << genExpr(ifs->cond.get(), offsets);
-        out << "    cmp eax, 0\n";
-        out << "    je " << Lelse << "\n";
-        out << genStmt(ifs->thenStmt.get(), offsets);
-        out << "    jmp " << Lend << "\n";
-        out << Lelse << ":\n";
-        if(ifs->elseStmt) out << genStmt(ifs->elseStmt.get(), offsets);
-        out << Lend << ":\n";
-        return out.str();
+    void ifEnd(IfStmt *ifs, StmtMarks &m){
+        cg.appendLabel(out, "", ifs->elseStmt ? m.b : m.a, ":\n");
     }
-    if(auto *ws = dynamic_cast<WhileStmt*>(n)){
-        std::string Ltop = emitLabel();
-        std::string Lend = emitLabel();
-        out << Ltop << ":\n";
-        out << genExpr(ws->cond.get(), offsets);
+    // m.a = loop top, m.b = end label
+    void whileBegin(WhileStmt *ws, StmtMarks &m){
+        m.a = cg.emitLabel();
+        m.b = cg.emitLabel();
+        cg.appendLabel(out, "", m.a, ":\n");
+        cg.genExpr(ws->cond, out);
         out << "    cmp eax, 0\n";
-        out << "    je " << Lend << "\n";
-        out << genStmt(ws->body.get(), offsets);
-        out << "    jmp " << Ltop << "\n";
-        out << Lend << ":\n";
-        return out.str();
+        cg.appendLabel(out, "    je ", m.b, "\n");
     }
-    if(auto *bs = dynamic_cast<BlockStmt*>(n)){
-        for(auto &s : bs->stmts) out << genStmt(s.get(), offsets);
-        return out.str();
+    void whileEnd(WhileStmt *, StmtMarks &m){
+        cg.appendLabel(out, "    jmp ", m.a, "\n");
+        cg.appendLabel(out, "", m.b, ":\n");
     }
-    return out.str();
+};
+
+void CodeGen::genStmt(Stmt *root, AsmOut &out){
+    StmtEmitter e{*this, out};
+    stmts.walk(root, e);
 }
 
-std::string CodeGen::genExpr(Node *n, std::map<std::string,int> &offsets){
-    std::ostringstream out;
-    if(auto *intn = dynamic_cast<Integer*>(n)){
-        out << "    mov eax, " << intn->value << "\n";
-        return out.str();
+// instruction sequences for the binary operators, applied to eax (left)
+// and ebx (right) with the result in eax; && and || are handled separately
+static std::string_view binaryCode(BinOp op){
+    switch(op){
+        case BinOp::Add: return "    add eax, ebx\n";
+        case BinOp::Sub: return "    sub eax, ebx\n";
+        case BinOp::Mul: return "    imul eax, ebx\n";
+        // sign-extend eax into edx:eax for the division
+        case BinOp::Div: return "    cdq\n    idiv ebx\n";
+        case BinOp::Mod: return "    cdq\n    idiv ebx\n    mov eax, edx\n";
+        case BinOp::Eq: return "    cmp eax, ebx\n    sete al\n    movzx eax, al\n";
+        case BinOp::Ne: return "    cmp eax, ebx\n    setne al\n    movzx eax, al\n";
+        case BinOp::Lt: return "    cmp eax, ebx\n    setl al\n    movzx eax, al\n";
+        case BinOp::Le: return "    cmp eax, ebx\n    setle al\n    movzx eax, al\n";
+        case BinOp::Gt: return "    cmp eax, ebx\n    setg al\n    movzx eax, al\n";
+        case BinOp::Ge: return "    cmp eax, ebx\n    setge al\n    movzx eax, al\n";
+        // lhs is the dummy 0; negate the operand itself
+        case BinOp::Neg: return "    mov eax, ebx\n    neg eax\n";
+        default: return {};
     }
-    if(auto *vn = dynamic_cast<VarExpr*>(n)){
-        auto it = offsets.find(vn->name);
-        if(it == offsets.end()){
-            throw std::runtime_error("Undefined variable " + vn->name);
+}
+
+// Expressions are generated like statements, with an explicit stack of
+// nodes and how far each has got, so nesting depth costs no native stack.
+void CodeGen::genExpr(Node *root, AsmOut &out){
+    auto &st = exprWork;
+    st.clear();
+    st.push_back(ExprWork{root, 0});
+    while(!st.empty()){
+        ExprWork &w = st.back();
+        Node *n = w.n;
+        if(n->kind == NodeKind::Integer){
+            out << "    mov eax, ";
+            out << static_cast<Integer*>(n)->value;
+            out << '\n';
+            st.pop_back();
+            continue;
         }
-        int off = it->second;
-        out << "    mov eax, DWORD PTR [rbp" << off << "]\n";
-        return out.str();
-    }
-    if(auto *bin = dynamic_cast<Binary*>(n)){
-        std::string op = bin->op;
-        if(op == "="){
-            // left must be VarExpr
-            auto *leftVar = dynamic_cast<VarExpr*>(bin->lhs.get());
-            if(!leftVar) throw std::runtime_error("Left side of assignment must be variable");
-            out << genExpr(bin->rhs.get(), offsets);
-            int off = offsets[leftVar->name];
-            out << "    mov DWORD PTR [rbp" << off << "], eax\n";
-            return out.str();
+        if(n->kind == NodeKind::Var){
+            emitLocal(out, "    mov eax, ", static_cast<VarExpr*>(n)->slot, "\n");
+            st.pop_back();
+            continue;
+        }
+        if(n->kind != NodeKind::Binary) throw CompileError(0, "Unknown expr node in codegen");
+        auto *bin = static_cast<Binary*>(n);
+        if(bin->op == BinOp::Assign){
+            // the parser only accepts a variable on the left
+            if(w.state == 0){
+                w.state = 1;
+                st.push_back(ExprWork{bin->rhs, 0});
+                continue;
+            }
+            emitLocal(out, "    mov ", static_cast<VarExpr*>(bin->lhs)->slot, ", eax\n");
+            st.pop_back();
+            continue;
         }
         // general binary: evaluate lhs into eax, push, eval rhs into eax, pop into ebx, operate
-        out << genExpr(bin->lhs.get(), offsets);
-        out << "    push rax\n";
-        out << genExpr(bin->rhs.get(), offsets);
-        out << "    mov ebx, eax\n";
-        out << "    pop rax\n";
+        if(w.state == 0){
+            w.state = 1;
+            st.push_back(ExprWork{bin->lhs, 0});
+            continue;
+        }
+        if(w.state == 1){
+            Node *r = bin->rhs;
+            if(r->kind == NodeKind::Integer){
+                // a constant or local operand is loaded into ebx directly,
+                // so eax need not be saved around it
+                out << "    mov ebx, ";
+                out << static_cast<Integer*>(r)->value;
+                out << '\n';
+            } else if(r->kind == NodeKind::Var){
+                emitLocal(out, "    mov ebx, ", static_cast<VarExpr*>(r)->slot, "\n");
+            } else {
+                out << "    push rax\n";
+                w.state = 2;
+                st.push_back(ExprWork{r, 0});
+                continue;
+            }
+        } else {
+            out << "    mov ebx, eax\n";
+            out << "    pop rax\n";
+        }
         // now lhs in eax, rhs in ebx
-        if(op == "+") out << "    add eax, ebx\n";
-        else if(op == "-") out << "    sub eax, ebx\n";
-        else if(op == "*") out << "    imul eax, ebx\n";
-        else if(op == "/"){
-            // dividend in rax (eax), divisor in ebx (ebx). Need sign-extend to rdx:eax
-            out << "    cdq\n";
-            out << "    idiv ebx\n";
-        } else if(op == "%"){
-            out << "    cdq\n";
-            out << "    idiv ebx\n";
-            out << "    mov eax, edx\n";
-        } else if(op == "=="){
-            out << "    cmp eax, ebx\n";
-            out << "    sete al\n";
-            out << "    movzx eax, al\n";
-        } else if(op == "!="){
-            out << "    cmp eax, ebx\n";
-            out << "    setne al\n";
-            out << "    movzx eax, al\n";
-        } else if(op == "<"){
-            out << "    cmp eax, ebx\n";
-            out << "    setl al\n";
-            out << "    movzx eax, al\n";
-        } else if(op == "<="){
-            out << "    cmp eax, ebx\n";
-            out << "    setle al\n";
-            out << "    movzx eax, al\n";
-        } else if(op == ">"){
-            out << "    cmp eax, ebx\n";
-            out << "    setg al\n";
-            out << "    movzx eax, al\n";
-        } else if(op == ">="){
-            out << "    cmp eax, ebx\n";
-            out << "    setge al\n";
-            out << "    movzx eax, al\n";
-        } else if(op == "&&"){
-            // short-circuit: eax = lhs, if zero -> 0 else => evaluate rhs
-            std::string Lzero = emitLabel();
-            std::string Ldone = emitLabel();
+        if(bin->op == BinOp::And){
+            // eax = lhs, if zero -> 0 else => rhs != 0 (both sides are evaluated)
+            int Lzero = emitLabel();
+            int Ldone = emitLabel();
             out << "    cmp eax, 0\n";
-            out << "    je " << Lzero << "\n";
+            appendLabel(out, "    je ", Lzero, "\n");
             out << "    mov eax, ebx\n"; // rhs result
             out << "    cmp eax, 0\n";
             out << "    setne al\n";
             out << "    movzx eax, al\n";
-            out << "    jmp " << Ldone << "\n";
-            out << Lzero << ":\n";
+            appendLabel(out, "    jmp ", Ldone, "\n");
+            appendLabel(out, "", Lzero, ":\n");
             out << "    mov eax, 0\n";
-            out << Ldone << ":\n";
-        } else if(op == "||"){
-            std::string Ltrue = emitLabel();
-            std::string Ldone = emitLabel();
+            appendLabel(out, "", Ldone, ":\n");
+        } else if(bin->op == BinOp::Or){
+            int Ltrue = emitLabel();
+            int Ldone = emitLabel();
             out << "    cmp eax, 0\n";
-            out << "    jne " << Ltrue << "\n";
+            appendLabel(out, "    jne ", Ltrue, "\n");
             out << "    mov eax, ebx\n";
             out << "    cmp eax, 0\n";
             out << "    setne al\n";
             out << "    movzx eax, al\n";
-            out << "    jmp " << Ldone << "\n";
-            out << Ltrue << ":\n";
+            appendLabel(out, "    jmp ", Ldone, "\n");
+            appendLabel(out, "", Ltrue, ":\n");
             out << "    mov eax, 1\n";
-            out << Ldone << ":\n";
-        } else if(op == "neg"){
-            out << "    neg eax\n";
+            appendLabel(out, "", Ldone, ":\n");
+        } else if(std::string_view code = binaryCode(bin->op); !code.empty()){
+            out << code;
         } else {
-            throw std::runtime_error("Unknown binary op: " + op);
+            throw CompileError(0, "Unknown binary op in codegen");
         }
-        return out.str();
+        st.pop_back();
     }
-    throw std::runtime_error("Unknown expr node in codegen");
 }
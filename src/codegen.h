@@ -1,18 +1,82 @@
 #pragma once
 #include "ast.h"
+#include <algorithm>
+#include <charconv>
+#include <cstring>
 #include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Generated code per function, keyed on the function's source text. Labels
+// are function-local, so a function's output depends on nothing else.
+struct FunctionCache {
+    std::unordered_map<std::string, std::string> entries;
+    // the cache is dropped wholesale when either limit would be exceeded;
+    // functions whose source plus code alone exceed maxBytes are not cached
+    size_t maxEntries = 4096; // 0 disables the cache
+    size_t maxBytes = 64u << 20; // total size of keys plus values
+    size_t bytes = 0;
+    size_t hits = 0, misses = 0;
+};
+
+// Buffer the assembly is written to. std::string::append is an out-of-line
+// call per piece, which dominated code generation on large inputs; this
+// keeps its own length and copies into a string grown ahead of it.
+class AsmOut {
+public:
+    explicit AsmOut(size_t sizeHint = 0){ buf.reserve(sizeHint); }
+    AsmOut &operator<<(std::string_view s){
+        std::memcpy(room(s.size()), s.data(), s.size());
+        len += s.size();
+        return *this;
+    }
+    AsmOut &operator<<(char c){
+        *room(1) = c;
+        len++;
+        return *this;
+    }
+    AsmOut &operator<<(int v){
+        char *p = room(11);
+        len += std::to_chars(p, p + 11, v).ptr - p;
+        return *this;
+    }
+    size_t size() const { return len; }
+    std::string_view view(size_t from) const { return std::string_view(buf).substr(from, len - from); }
+    std::string take(){ // the text so far; leaves the buffer empty
+        buf.resize(len);
+        len = 0;
+        return std::move(buf);
+    }
+private:
+    std::string buf; // bytes past len are scratch
+    size_t len = 0;
+    char *room(size_t n){
+        // grow in steps, so reserved memory is only touched once it is used;
+        // past the capacity std::string doubles it
+        if(len + n > buf.size()) buf.resize(len + std::max(n, GrowStep));
+        return &buf[len];
+    }
+    static const size_t GrowStep = 64u << 10;
+};
 
 class CodeGen {
 public:
-    CodeGen(const Program &p);
+    CodeGen(const Program &p, FunctionCache *cache = nullptr);
     std::string generate(); // returns assembly as string
 private:
     const Program &prog;
+    FunctionCache *cache;
+    const Function *curFunc = nullptr;
     int labelCounter = 0;
-    std::string emitLabel();
-    std::string emitFunction(const Function &f);
-    // simple symbol table per function: name -> stack offset
-    void assignStackOffsets(const Function &f, std::map<std::string,int> &offsets, int &frameSize);
-    std::string genStmt(Node *n, std::map<std::string,int> &offsets);
-    std::string genExpr(Node *n, std::map<std::string,int> &offsets);
+    int emitLabel(); // next label number in curFunc
+    void appendLabel(AsmOut &out, std::string_view prefix, int label, std::string_view suffix);
+    void emitFunction(const Function &f, AsmOut &out); // appends f's code
+    // append the code for n to out
+    void genStmt(Stmt *n, AsmOut &out);
+    void genExpr(Node *n, AsmOut &out);
+    struct StmtEmitter; // genStmt's hooks for StmtWalker
+    StmtWalker stmts;
+    struct ExprWork { Node *n; int state; };
+    std::vector<ExprWork> exprWork; // genExpr's stack, reused across calls
 };
@@ -0,0 +1,10 @@
+#pragma once
+#include <stdexcept>
+#include <string>
+
+// Error raised by the front end / code generator. Carries the source line
+// (0 if unknown) so library callers get it as structured data.
+struct CompileError : std::runtime_error {
+    int line;
+    CompileError(int line_, const std::string &msg): std::runtime_error(msg), line(line_) {}
+};
@@ -1,27 +1,38 @@
 // src/lexer.cpp  
 #include "lexer.h"
-#include <cctype>
-#include <unordered_map>
+#include "error.h"
 
-static std::unordered_map<std::string, TokenKind> keywords = {
-    {"int", TokenKind::KwInt},
-    {"return", TokenKind::KwReturn},
-    {"if", TokenKind::KwIf},
-    {"else", TokenKind::KwElse},
-    {"while", TokenKind::KwWhile}
-};
+// ASCII character classes; the <cctype> versions go through the locale
+// table on every byte, which showed up in the lexer's profile
+static bool isSpace(char c){ return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f'; }
+static bool isDigit(char c){ return c >= '0' && c <= '9'; }
+static bool isIdentStart(char c){ return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_'; }
 
-Lexer::Lexer(const std::string &src_) : src(src_) {
+// keyword lookup; a plain function rather than a table so the lexer has no
+// global state
+static TokenKind keywordKind(std::string_view s){
+    if(s == "int") return TokenKind::KwInt;
+    if(s == "return") return TokenKind::KwReturn;
+    if(s == "if") return TokenKind::KwIf;
+    if(s == "else") return TokenKind::KwElse;
+    if(s == "while") return TokenKind::KwWhile;
+    return TokenKind::Identifier;
+}
 
-    cur = Token{TokenKind::End, "", 0, line};
-    cur = next();
+void TokenBuffer::clear(){
+    kinds.clear();
+    offsets.clear();
+    lengths.clear();
+    lines.clear();
 }
 
+Lexer::Lexer(std::string_view src_) : src(src_) {}
+
 void Lexer::skipWhitespace(){
     while(i < src.size()){
         char c = src[i];
         if(c == '\n') { line++; i++; continue; }
-        if(isspace((unsigned char)c)) { i++; continue; }
+        if(isSpace(c)) { i++; continue; }
         if(c == '/' && i+1 < src.size() && src[i+1] == '/'){
             // line comment
             i+=2;
@@ -41,85 +52,80 @@ void Lexer::skipWhitespace(){
     }
 }
 
-bool Lexer::startsWith(const std::string &s){
-    return src.compare(i, s.size(), s) == 0;
+TokenBuffer Lexer::tokenize(){
+    TokenBuffer out;
+    tokenize(out);
+    return out;
 }
 
-Token Lexer::makeToken(TokenKind k, const std::string &t){
-    Token tk; tk.kind = k; tk.text = t; tk.number = 0; tk.line = line; return tk;
+void Lexer::tokenize(TokenBuffer &out){
+    // token spans are stored as 32-bit offsets and lengths
+    if(src.size() > UINT32_MAX)
+        throw CompileError(0, "Source too large (" + std::to_string(src.size()) + " bytes, limit " + std::to_string(UINT32_MAX) + ")");
+    out.clear();
+    out.src = src;
+    i = 0;
+    line = 1;
+    // every token but End takes at least one byte, so this never regrows;
+    // pages past the tokens actually written are never touched
+    size_t bound = src.size() + 1;
+    out.kinds.reserve(bound);
+    out.offsets.reserve(bound);
+    out.lengths.reserve(bound);
+    out.lines.reserve(bound);
+    while(true){
+        skipWhitespace();
+        size_t start = i;
+        int startLine = line;
+        TokenKind k = lexOne();
+        out.kinds.push_back(k);
+        out.offsets.push_back((uint32_t)start);
+        out.lengths.push_back((uint32_t)(i - start));
+        out.lines.push_back(startLine);
+        if(k == TokenKind::End) break;
+    }
 }
 
-Token Lexer::next(){
-    skipWhitespace();
-    if(i >= src.size()){
-        Token t = makeToken(TokenKind::End, "");
-        cur = t;
-        return cur;
-    }
+TokenKind Lexer::lexOne(){
+    if(i >= src.size()) return TokenKind::End;
     char c = src[i];
 
-    // multi-char ops
-    if(startsWith("==")) { i+=2; Token t = makeToken(TokenKind::Eq, "=="); cur = t; return cur; }
-    if(startsWith("!=")) { i+=2; Token t = makeToken(TokenKind::Neq, "!="); cur = t; return cur; }
-    if(startsWith("<=")) { i+=2; Token t = makeToken(TokenKind::Le, "<="); cur = t; return cur; }
-    if(startsWith(">=")) { i+=2; Token t = makeToken(TokenKind::Ge, ">="); cur = t; return cur; }
-    if(startsWith("&&")) { i+=2; Token t = makeToken(TokenKind::And, "&&"); cur = t; return cur; }
-    if(startsWith("||")) { i+=2; Token t = makeToken(TokenKind::Or, "||"); cur = t; return cur; }
-
-    // single-char tokens
+    // operators; two-char ones are checked by peeking at the next byte
+    char n = i+1 < src.size() ? src[i+1] : '\0';
     i++;
     switch(c){
-        case '+': { Token t = makeToken(TokenKind::Plus, "+"); cur = t; return cur; }
-        case '-': { Token t = makeToken(TokenKind::Minus, "-"); cur = t; return cur; }
-        case '*': { Token t = makeToken(TokenKind::Star, "*"); cur = t; return cur; }
-        case '/': { Token t = makeToken(TokenKind::Slash, "/"); cur = t; return cur; }
-        case '%': { Token t = makeToken(TokenKind::Percent, "%"); cur = t; return cur; }
-        case '(': { Token t = makeToken(TokenKind::LParen, "("); cur = t; return cur; }
-        case ')': { Token t = makeToken(TokenKind::RParen, ")"); cur = t; return cur; }
-        case '{': { Token t = makeToken(TokenKind::LBrace, "{"); cur = t; return cur; }
-        case '}': { Token t = makeToken(TokenKind::RBrace, "}"); cur = t; return cur; }
-        case ';': { Token t = makeToken(TokenKind::Semicolon, ";"); cur = t; return cur; }
-        case ',': { Token t = makeToken(TokenKind::Comma, ","); cur = t; return cur; }
-        case '=': { Token t = makeToken(TokenKind::Assign, "="); cur = t; return cur; }
-        case '<': { Token t = makeToken(TokenKind::Lt, "<"); cur = t; return cur; }
-        case '>': { Token t = makeToken(TokenKind::Gt, ">"); cur = t; return cur; }
+        case '+': return TokenKind::Plus;
+        case '-': return TokenKind::Minus;
+        case '*': return TokenKind::Star;
+        case '/': return TokenKind::Slash;
+        case '%': return TokenKind::Percent;
+        case '(': return TokenKind::LParen;
+        case ')': return TokenKind::RParen;
+        case '{': return TokenKind::LBrace;
+        case '}': return TokenKind::RBrace;
+        case ';': return TokenKind::Semicolon;
+        case ',': return TokenKind::Comma;
+        case '=': if(n == '=') { i++; return TokenKind::Eq; } return TokenKind::Assign;
+        case '<': if(n == '=') { i++; return TokenKind::Le; } return TokenKind::Lt;
+        case '>': if(n == '=') { i++; return TokenKind::Ge; } return TokenKind::Gt;
+        case '!': if(n == '=') { i++; return TokenKind::Neq; } break;
+        case '&': if(n == '&') { i++; return TokenKind::And; } break;
+        case '|': if(n == '|') { i++; return TokenKind::Or; } break;
         default: break;
     }
 
     // number
-    if(isdigit((unsigned char)c)){
-        size_t j = i-1;
-        while(j < src.size() && isdigit((unsigned char)src[j])) j++;
-        std::string s = src.substr(i-1, j - (i-1));
-        i = j;
-        Token t = makeToken(TokenKind::Number, s);
-        t.number = std::stoi(s);
-        cur = t;
-        return cur;
+    if(isDigit(c)){
+        while(i < src.size() && isDigit(src[i])) i++;
+        return TokenKind::Number;
     }
 
     // identifier or keyword
-    if(isalpha((unsigned char)c) || c == '_'){
-        size_t j = i-1;
-        while(j < src.size() && (isalnum((unsigned char)src[j]) || src[j]=='_')) j++;
-        std::string s = src.substr(i-1, j - (i-1));
-        i = j;
-        auto it = keywords.find(s);
-        if(it != keywords.end()){
-            Token t = makeToken(it->second, s);
-            cur = t;
-            return cur;
-        }
-        Token t = makeToken(TokenKind::Identifier, s);
-        cur = t;
-        return cur;
+    if(isIdentStart(c)){
+        size_t start = i-1;
+        while(i < src.size() && (isIdentStart(src[i]) || isDigit(src[i]))) i++;
+        return keywordKind(src.substr(start, i - start));
     }
 
-    Token t = makeToken(TokenKind::Unknown, std::string(1,c));
-    cur = t;
-    return cur;
-}
-
-Token Lexer::peek(){
-    return cur;
+    return TokenKind::Unknown;
 }
@@ -1,8 +1,10 @@
 #pragma once
 #include <string>
+#include <string_view>
 #include <vector>
+#include <cstdint>
 
-enum class TokenKind {
+enum class TokenKind : uint8_t {
     End, Identifier, Number,
     KwInt, KwReturn, KwIf, KwElse, KwWhile,
     Plus, Minus, Star, Slash, Percent,
@@ -12,24 +14,30 @@ enum class TokenKind {
     Unknown
 };
 
-struct Token {
-    TokenKind kind;
-    std::string text;
-    int number; // if Number
-    int line;
+// Whole token stream in struct-of-arrays layout. Token i is described by
+// kinds[i], offsets[i]/lengths[i] (its span in the source) and lines[i].
+// The last token is always End, so lookahead past it stays in bounds.
+struct TokenBuffer {
+    std::string_view src;
+    std::vector<TokenKind> kinds;
+    std::vector<uint32_t> offsets;
+    std::vector<uint32_t> lengths;
+    std::vector<int> lines;
+
+    size_t size() const { return kinds.size(); }
+    std::string_view text(size_t idx) const { return src.substr(offsets[idx], lengths[idx]); }
+    void clear();
 };
 
 class Lexer {
 public:
-    Lexer(const std::string &src);
-    Token next();
-    Token peek();
+    Lexer(std::string_view src);
+    TokenBuffer tokenize();       // lex the whole input up front
+    void tokenize(TokenBuffer &out); // same, reusing out's storage
 private:
-    const std::string src;
+    std::string_view src;
     size_t i = 0;
     int line = 1;
-    Token cur;
     void skipWhitespace();
-    bool startsWith(const std::string &s);
-    Token makeToken(TokenKind k, const std::string &t);
+    TokenKind lexOne(); // lexes one token starting at i, advances past it
 };
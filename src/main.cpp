@@ -1,33 +1,97 @@
-#include "lexer.h"
-#include "parser.h"
-#include "codegen.h"
+#include "tinycc.h"
+#include "server.h"
+#include <cstdlib>
+#include <cstring>
 #include <fstream>
 #include <iostream>
 
+static int usage(){
+    std::cerr << "Usage: tinycc <source.tc>\n"
+                 "       tinycc --interp [--stats] [--max-steps N] <source.tc>\n"
+                 "       tinycc --daemon [--socket <path>]\n"
+                 "       tinycc --client [--socket <path>] (<source.tc> | --stats | --stop)\n";
+    return 1;
+}
+
+// reads the whole file in one go; false if it cannot be opened
+static bool readFile(const std::string &path, std::string &out){
+    std::ifstream in(path, std::ios::binary);
+    if(!in) return false;
+    in.seekg(0, std::ios::end);
+    std::streamoff size = in.tellg();
+    in.seekg(0, std::ios::beg);
+    if(size < 0) return false;
+    out.resize((size_t)size);
+    in.read(&out[0], size);
+    return (bool)in;
+}
+
 int main(int argc, char **argv){
-    if(argc < 2){
-        std::cerr << "Usage: tinycc <source.tc>\n";
-        return 1;
+    if(argc < 2) return usage();
+
+    if(!std::strcmp(argv[1], "--daemon") || !std::strcmp(argv[1], "--client")){
+        bool daemon = !std::strcmp(argv[1], "--daemon");
+        std::string socketPath;
+        char op = 'C';
+        std::string file;
+        for(int a = 2; a < argc; a++){
+            if(!std::strcmp(argv[a], "--socket") && a + 1 < argc) socketPath = argv[++a];
+            else if(!daemon && !std::strcmp(argv[a], "--stats")) op = 'S';
+            else if(!daemon && !std::strcmp(argv[a], "--stop")) op = 'Q';
+            else if(!daemon && argv[a][0] != '-' && file.empty()) file = argv[a];
+            else return usage();
+        }
+        if(socketPath.empty()) socketPath = defaultSocketPath();
+        if(socketPath.empty()) return 1;
+        if(daemon) return runServer(socketPath);
+        if(op == 'C' && file.empty()) return usage();
+        return runClient(socketPath, op, file);
+    }
+
+    if(!std::strcmp(argv[1], "--interp")){
+        bool stats = false;
+        std::string file;
+        CompileOptions opts;
+        for(int a = 2; a < argc; a++){
+            if(!std::strcmp(argv[a], "--stats")) stats = true;
+            else if(!std::strcmp(argv[a], "--max-steps") && a + 1 < argc){
+                char *end;
+                opts.maxSteps = std::strtoull(argv[++a], &end, 10);
+                if(*end || argv[a][0] == '-' || !argv[a][0]) return usage();
+            }
+            else if(argv[a][0] != '-' && file.empty()) file = argv[a];
+            else return usage();
+        }
+        if(file.empty()) return usage();
+        std::string src;
+        if(!readFile(file, src)){ std::cerr << "Cannot open file\n"; return 1; }
+        RunResult res = run(src, opts);
+        if(!res.ok){
+            for(auto &d : res.diagnostics) std::cerr << "Error: " << d.message << "\n";
+            return 1;
+        }
+        if(stats){
+            double mops = res.seconds > 0 ? res.steps / res.seconds / 1e6 : 0;
+            std::cerr << "interp: " << res.steps << " ops in " << res.seconds * 1e3 << " ms ("
+                      << mops << " Mops/s)\n";
+        }
+        // like running the compiled program: main's value is the exit status
+        return res.value;
     }
-    std::ifstream in(argv[1]);
-    if(!in){ std::cerr << "Cannot open file\n"; return 1; }
-    std::string src((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
 
-    try {
-        Lexer lx(src);
-        Parser p(lx);
-        Program prog = p.parse();
-        CodeGen cg(prog);
-        std::string asmcode = cg.generate();
-        std::string outAsm = std::string(argv[1]) + ".s";
-        std::ofstream out(outAsm);
-        out << asmcode;
-        out.close();
-        std::cout << "Assembly written to " << outAsm << "\n";
-        std::cout << "Now assemble & link with: gcc -no-pie -o prog " << outAsm << "\n";
-    } catch(std::exception &e){
-        std::cerr << "Error: " << e.what() << "\n";
+    std::string src;
+    if(!readFile(argv[1], src)){ std::cerr << "Cannot open file\n"; return 1; }
+
+    CompileResult res = compile(src);
+    if(!res.ok){
+        for(auto &d : res.diagnostics) std::cerr << "Error: " << d.message << "\n";
         return 1;
     }
+    std::string outAsm = std::string(argv[1]) + ".s";
+    std::ofstream out(outAsm);
+    out << res.output;
+    out.close();
+    std::cout << "Assembly written to " << outAsm << "\n";
+    std::cout << "Now assemble & link with: gcc -no-pie -o prog " << outAsm << "\n";
     return 0;
 }
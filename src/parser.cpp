@@ -1,34 +1,45 @@
 // src/parser.cpp
 #include "parser.h"
+#include "error.h"
+#include <charconv>
 #include <stdexcept>
 #include <iostream>
 
-Parser::Parser(Lexer &lex_): lex(lex_) {}
+Parser::Parser(const TokenBuffer &toks_, Arena &arena_, size_t maxDepth_): toks(toks_), arena(arena_), maxDepth(maxDepth_) {}
 
-// helper: current token (does NOT advance)
-Token Parser::cur(){ return lex.peek(); }
+// helper: kind of the current token, or of one further ahead (does NOT advance)
+TokenKind Parser::cur(size_t ahead) const {
+    size_t idx = pos + ahead;
+    // the buffer always ends with End, so clamp lookahead onto it
+    if(idx >= toks.size()) idx = toks.size() - 1;
+    return toks.kinds[idx];
+}
+
+std::string_view Parser::curText() const { return toks.text(pos); }
+
+int Parser::curLine() const { return toks.lines[pos]; }
 
-// consume and return the token we just advanced past
-Token Parser::consume(){ Token t = lex.next(); (void)lex.peek(); return t; }
+// advance past the current token (never past End)
+void Parser::consume(){ if(pos + 1 < toks.size()) pos++; }
 
 bool Parser::accept(TokenKind k){
-    if(cur().kind == k){
+    if(cur() == k){
         consume();
         return true;
     }
     return false;
 }
 
-void Parser::expect(TokenKind k, const std::string &msg){
-    if(cur().kind != k){
-        throw std::runtime_error("Parse error at line " + std::to_string(cur().line) + ": expected " + msg + ", got '" + cur().text + "'");
+void Parser::expect(TokenKind k, const char *msg){
+    if(cur() != k){
+        throw CompileError(curLine(), "Parse error at line " + std::to_string(curLine()) + ": expected " + msg + ", got '" + std::string(curText()) + "'");
     }
     consume();
 }
 
 Program Parser::parse(){
     Program p;
-    while(cur().kind != TokenKind::End){
+    while(cur() != TokenKind::End){
         p.funcs.push_back(parseFunction());
     }
     return p;
@@ -36,176 +47,214 @@ Program Parser::parse(){
 
 Function Parser::parseFunction(){
     // only: int IDENT() { ... }
+    size_t begin = toks.offsets[pos];
     expect(TokenKind::KwInt, "int");
-    if(cur().kind != TokenKind::Identifier) throw std::runtime_error("expected function name");
-    std::string name = cur().text;
+    if(cur() != TokenKind::Identifier) throw CompileError(curLine(), "expected function name");
+    Function f;
+    f.name = std::string(curText());
     consume();
     expect(TokenKind::LParen, "(");
     expect(TokenKind::RParen, ")");
-    auto block = parseBlock();
-    Function f;
-    f.name = name;
-    // move statements from block into function body
-    for(auto &s : block->stmts) f.body.push_back(std::move(s));
+    decls.clear();
+    uses.clear();
+    f.body = parseBlock();
+    size_t end = toks.offsets[pos-1] + toks.lengths[pos-1];
+    f.text = toks.src.substr(begin, end - begin);
+    resolveLocals(f, decls, uses);
     return f;
 }
 
-std::unique_ptr<BlockStmt> Parser::parseBlock(){
-    expect(TokenKind::LBrace, "{");
-    auto blk = std::make_unique<BlockStmt>();
-    while(cur().kind != TokenKind::RBrace && cur().kind != TokenKind::End){
-        blk->stmts.push_back(parseStatement());
+BlockStmt *Parser::parseBlock(){
+    if(cur() != TokenKind::LBrace) expect(TokenKind::LBrace, "{"); // throws
+    return static_cast<BlockStmt*>(parseStatement());
+}
+
+void Parser::checkDepth(size_t depth){
+    if(depth > maxDepth)
+        throw CompileError(curLine(), "Nesting too deep at line " + std::to_string(curLine()) + " (limit " + std::to_string(maxDepth) + ")");
+}
+
+// Statements nest through blocks, if and while. Instead of recursing per
+// level, keep the constructs still waiting for a sub-statement on an
+// explicit stack; a finished statement is handed to the innermost one.
+Stmt *Parser::parseStatement(){
+    open.clear();
+    while(true){
+        // open constructs until a complete statement comes out
+        Stmt *done = nullptr;
+        while(!done){
+            if(cur() == TokenKind::LBrace){
+                consume();
+                open.push_back(Frame{Open::Block, arena.make<BlockStmt>(), nullptr, nullptr});
+                checkDepth(open.size());
+                if(cur() == TokenKind::RBrace || cur() == TokenKind::End){
+                    expect(TokenKind::RBrace, "}");
+                    done = open.back().block;
+                    open.pop_back();
+                }
+            } else if(cur() == TokenKind::KwIf || cur() == TokenKind::KwWhile){
+                Open kind = cur() == TokenKind::KwIf ? Open::IfThen : Open::While;
+                consume();
+                expect(TokenKind::LParen, "(");
+                Node *cond = parseExpr();
+                expect(TokenKind::RParen, ")");
+                open.push_back(Frame{kind, nullptr, cond, nullptr});
+                checkDepth(open.size());
+            } else {
+                done = parseSimpleStatement();
+            }
+        }
+        // hand it outwards, closing every construct it completes
+        while(true){
+            if(open.empty()) return done;
+            Frame &f = open.back();
+            if(f.kind == Open::Block){
+                f.block->append(done);
+                if(cur() != TokenKind::RBrace && cur() != TokenKind::End) break;
+                expect(TokenKind::RBrace, "}");
+                done = f.block;
+            } else if(f.kind == Open::IfThen){
+                if(accept(TokenKind::KwElse)){
+                    f.thenStmt = done;
+                    f.kind = Open::IfElse;
+                    break;
+                }
+                done = arena.make<IfStmt>(f.cond, done, nullptr);
+            } else if(f.kind == Open::IfElse){
+                done = arena.make<IfStmt>(f.cond, f.thenStmt, done);
+            } else {
+                done = arena.make<WhileStmt>(f.cond, done);
+            }
+            open.pop_back();
+        }
     }
-    expect(TokenKind::RBrace, "}");
-    return blk;
 }
 
-NodePtr Parser::parseStatement(){
-    if(cur().kind == TokenKind::KwInt){
+// declaration, return or expression statement
+Stmt *Parser::parseSimpleStatement(){
+    if(cur() == TokenKind::KwInt){
         consume();
-        if(cur().kind != TokenKind::Identifier) throw std::runtime_error("expected identifier in decl");
-        std::string name = cur().text; consume();
-        NodePtr init = nullptr;
+        if(cur() != TokenKind::Identifier) throw CompileError(curLine(), "expected identifier in decl");
+        std::string_view name = curText(); consume();
+        Node *init = nullptr;
         if(accept(TokenKind::Assign)){
             init = parseExpr();
         }
         expect(TokenKind::Semicolon, ";");
-        return std::make_unique<DeclStmt>(name, std::move(init));
+        decls.push_back(arena.make<DeclStmt>(name, init));
+        return decls.back();
     }
-    if(cur().kind == TokenKind::KwReturn){
+    if(cur() == TokenKind::KwReturn){
         consume();
-        auto e = parseExpr();
+        Node *e = parseExpr();
         expect(TokenKind::Semicolon, ";");
-        return std::make_unique<ReturnStmt>(std::move(e));
-    }
-    if(cur().kind == TokenKind::KwIf){
-        consume();
-        expect(TokenKind::LParen, "(");
-        auto cond = parseExpr();
-        expect(TokenKind::RParen, ")");
-        auto thenS = parseStatement();
-        NodePtr elseS = nullptr;
-        if(accept(TokenKind::KwElse)){
-            elseS = parseStatement();
-        }
-        return std::make_unique<IfStmt>(std::move(cond), std::move(thenS), std::move(elseS));
-    }
-    if(cur().kind == TokenKind::KwWhile){
-        consume();
-        expect(TokenKind::LParen, "(");
-        auto cond = parseExpr();
-        expect(TokenKind::RParen, ")");
-        auto body = parseStatement();
-        return std::make_unique<WhileStmt>(std::move(cond), std::move(body));
-    }
-    if(cur().kind == TokenKind::LBrace){
-        return parseBlock();
+        return arena.make<ReturnStmt>(e);
     }
     // expression or assignment statement
-    auto e = parseAssignment();
+    Node *e = parseExpr();
     expect(TokenKind::Semicolon, ";");
-    return std::make_unique<ExprStmt>(std::move(e));
+    return arena.make<ExprStmt>(e);
 }
 
-// ----- FIXED parseAssignment -----
-// Now correctly checks if the left-hand side is a variable by dynamic_cast on left.get()
-NodePtr Parser::parseAssignment(){
-    auto left = parseLogicOr();
-    if(accept(TokenKind::Assign)){
-        // left must be VarExpr
-        VarExpr *v = dynamic_cast<VarExpr*>(left.get());
-        if(!v) throw std::runtime_error("Left side of assignment must be a variable (line " + std::to_string(cur().line) + ")");
-        auto rhs = parseAssignment(); // right-associative
-        return std::make_unique<Binary>("=", std::move(left), std::move(rhs));
-    }
-    return left;
-}
+namespace {
 
-NodePtr Parser::parseExpr(){ return parseAssignment(); }
+// binding power of the expression operators, loosest first
+enum Prec { PrecParen = -1, PrecAssign, PrecOr, PrecAnd, PrecEquality, PrecRelational, PrecAddSub, PrecMulDiv, PrecUnary };
 
-NodePtr Parser::parseLogicOr(){
-    auto node = parseLogicAnd();
-    while(accept(TokenKind::Or)){
-        node = std::make_unique<Binary>("||", std::move(node), parseLogicAnd());
-    }
-    return node;
-}
-
-NodePtr Parser::parseLogicAnd(){
-    auto node = parseEquality();
-    while(accept(TokenKind::And)){
-        node = std::make_unique<Binary>("&&", std::move(node), parseEquality());
-    }
-    return node;
-}
-
-NodePtr Parser::parseEquality(){
-    auto node = parseRelational();
-    while(true){
-        if(accept(TokenKind::Eq)){
-            node = std::make_unique<Binary>("==", std::move(node), parseRelational());
-        } else if(accept(TokenKind::Neq)){
-            node = std::make_unique<Binary>("!=", std::move(node), parseRelational());
-        } else break;
-    }
-    return node;
-}
+} // namespace
 
-NodePtr Parser::parseRelational(){
-    auto node = parseAddSub();
-    while(true){
-        if(accept(TokenKind::Lt)) node = std::make_unique<Binary>("<", std::move(node), parseAddSub());
-        else if(accept(TokenKind::Le)) node = std::make_unique<Binary>("<=", std::move(node), parseAddSub());
-        else if(accept(TokenKind::Gt)) node = std::make_unique<Binary>(">", std::move(node), parseAddSub());
-        else if(accept(TokenKind::Ge)) node = std::make_unique<Binary>(">=", std::move(node), parseAddSub());
-        else break;
+bool Parser::binaryOp(TokenKind k, PendingOp &out){
+    switch(k){
+        case TokenKind::Assign:  out = {BinOp::Assign, PrecAssign}; return true;
+        case TokenKind::Or:      out = {BinOp::Or, PrecOr}; return true;
+        case TokenKind::And:     out = {BinOp::And, PrecAnd}; return true;
+        case TokenKind::Eq:      out = {BinOp::Eq, PrecEquality}; return true;
+        case TokenKind::Neq:     out = {BinOp::Ne, PrecEquality}; return true;
+        case TokenKind::Lt:      out = {BinOp::Lt, PrecRelational}; return true;
+        case TokenKind::Le:      out = {BinOp::Le, PrecRelational}; return true;
+        case TokenKind::Gt:      out = {BinOp::Gt, PrecRelational}; return true;
+        case TokenKind::Ge:      out = {BinOp::Ge, PrecRelational}; return true;
+        case TokenKind::Plus:    out = {BinOp::Add, PrecAddSub}; return true;
+        case TokenKind::Minus:   out = {BinOp::Sub, PrecAddSub}; return true;
+        case TokenKind::Star:    out = {BinOp::Mul, PrecMulDiv}; return true;
+        case TokenKind::Slash:   out = {BinOp::Div, PrecMulDiv}; return true;
+        case TokenKind::Percent: out = {BinOp::Mod, PrecMulDiv}; return true;
+        default: return false;
     }
-    return node;
 }
 
-NodePtr Parser::parseAddSub(){
-    auto node = parseMulDiv();
-    while(true){
-        if(accept(TokenKind::Plus)) node = std::make_unique<Binary>("+", std::move(node), parseMulDiv());
-        else if(accept(TokenKind::Minus)) node = std::make_unique<Binary>("-", std::move(node), parseMulDiv());
-        else break;
+void Parser::reduce(){
+    PendingOp op = ops.back();
+    ops.pop_back();
+    Node *rhs = operands.back();
+    operands.pop_back();
+    if(op.prec == PrecUnary){
+        operands.push_back(arena.make<Binary>(BinOp::Neg, arena.make<Integer>(0), rhs));
+        return;
     }
-    return node;
+    Node *lhs = operands.back();
+    operands.pop_back();
+    operands.push_back(arena.make<Binary>(op.op, lhs, rhs));
 }
 
-NodePtr Parser::parseMulDiv(){
-    auto node = parseUnary();
+// Operator-precedence parse with explicit operand/operator stacks. Accepts
+// the same grammar as a recursive-descent chain (assignment, ||, &&,
+// equality, relational, +-, */%, unary minus, parentheses) but needs no
+// native stack per nesting level: `=` is right-associative, the rest left.
+Node *Parser::parseExpr(){
+    operands.clear();
+    ops.clear();
+    size_t parens = 0;
     while(true){
-        if(accept(TokenKind::Star)) node = std::make_unique<Binary>("*", std::move(node), parseUnary());
-        else if(accept(TokenKind::Slash)) node = std::make_unique<Binary>("/", std::move(node), parseUnary());
-        else if(accept(TokenKind::Percent)) node = std::make_unique<Binary>("%", std::move(node), parseUnary());
-        else break;
-    }
-    return node;
-}
+        // operand position: any prefix minuses and open parens, then an atom
+        while(true){
+            if(accept(TokenKind::Minus)) ops.push_back({BinOp::Neg, PrecUnary});
+            else if(accept(TokenKind::LParen)){ ops.push_back({BinOp::Assign, PrecParen}); parens++; }
+            else break;
+            checkDepth(ops.size());
+        }
+        operands.push_back(parsePrimary());
 
-NodePtr Parser::parseUnary(){
-    if(accept(TokenKind::Minus)){
-        auto r = parseUnary();
-        return std::make_unique<Binary>("neg", std::make_unique<Integer>(0), std::move(r));
+        // operator position: close parens until a binary operator or the end
+        PendingOp bin;
+        while(!binaryOp(cur(), bin)){
+            if(parens == 0 || cur() != TokenKind::RParen){
+                if(parens > 0) expect(TokenKind::RParen, ")"); // throws
+                while(!ops.empty()) reduce();
+                return operands.back();
+            }
+            consume();
+            while(ops.back().prec != PrecParen) reduce();
+            ops.pop_back();
+            parens--;
+        }
+        consume();
+        bool rightAssoc = bin.prec == PrecAssign;
+        while(!ops.empty() && ops.back().prec != PrecParen &&
+              (ops.back().prec > bin.prec || (!rightAssoc && ops.back().prec == bin.prec)))
+            reduce();
+        if(rightAssoc && operands.back()->kind != NodeKind::Var)
+            throw CompileError(curLine(), "Left side of assignment must be a variable (line " + std::to_string(curLine()) + ")");
+        ops.push_back(bin);
+        checkDepth(ops.size());
     }
-    return parsePrimary();
 }
 
-NodePtr Parser::parsePrimary(){
-    Token t = cur();
-    if(t.kind == TokenKind::Number){
+Node *Parser::parsePrimary(){
+    if(cur() == TokenKind::Number){
+        std::string_view text = curText();
+        int value = 0;
+        auto r = std::from_chars(text.data(), text.data() + text.size(), value);
+        if(r.ec != std::errc())
+            throw CompileError(curLine(), "Integer literal out of range: " + std::string(text) + " at line " + std::to_string(curLine()));
         consume();
-        return std::make_unique<Integer>(t.number);
+        return arena.make<Integer>(value);
     }
-    if(t.kind == TokenKind::Identifier){
+    if(cur() == TokenKind::Identifier){
+        std::string_view name = curText();
         consume();
-        return std::make_unique<VarExpr>(t.text);
-    }
-    if(accept(TokenKind::LParen)){
-        auto e = parseExpr();
-        expect(TokenKind::RParen, ")");
-        return e;
+        uses.push_back(arena.make<VarExpr>(name));
+        return uses.back();
     }
-    throw std::runtime_error("Unexpected token in primary: " + t.text + " at line " + std::to_string(t.line));
+    throw CompileError(curLine(), "Unexpected token in primary: " + std::string(curText()) + " at line " + std::to_string(curLine()));
 }
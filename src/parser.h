@@ -1,31 +1,59 @@
 #pragma once
 #include "lexer.h"
 #include "ast.h"
-#include <memory>
+#include "arena.h"
+#include <vector>
 
 class Parser {
 public:
-    Parser(Lexer &lex);
+    // maxDepth bounds statement and expression nesting; parsing itself
+    // uses heap stacks, so the limit only guards against runaway input
+    static const size_t DefaultMaxDepth = 1000000;
+    // nodes are allocated from arena; the tree refers to the source text
+    // that toks views
+    Parser(const TokenBuffer &toks, Arena &arena, size_t maxDepth = DefaultMaxDepth);
     Program parse();
 private:
-    Lexer &lex;
-    Token cur();
-    Token consume();
+    const TokenBuffer &toks;
+    Arena &arena;
+    size_t pos = 0;
+    size_t maxDepth;
+    TokenKind cur(size_t ahead = 0) const; // kind of token pos+ahead
+    std::string_view curText() const;
+    int curLine() const;
+    void consume();
     bool accept(TokenKind k);
-    void expect(TokenKind k, const std::string &msg="");
+    void expect(TokenKind k, const char *msg = "");
 
     // parse helpers
     Function parseFunction();
-    std::unique_ptr<BlockStmt> parseBlock();
-    NodePtr parseStatement();
-    NodePtr parseExpr();
-    NodePtr parseAssignment();
-    NodePtr parseLogicOr();
-    NodePtr parseLogicAnd();
-    NodePtr parseEquality();
-    NodePtr parseRelational();
-    NodePtr parseAddSub();
-    NodePtr parseMulDiv();
-    NodePtr parseUnary();
-    NodePtr parsePrimary();
+    BlockStmt *parseBlock();
+    Stmt *parseStatement();
+    Stmt *parseSimpleStatement();
+    Node *parseExpr();
+    Node *parsePrimary();
+    void checkDepth(size_t depth);
+
+    // Explicit stacks used by parseStatement and parseExpr. They are members
+    // so that their storage is reused from one statement to the next.
+    enum class Open { Block, IfThen, IfElse, While };
+    struct Frame {
+        Open kind;
+        BlockStmt *block;      // Block
+        Node *cond;            // IfThen / IfElse / While
+        Stmt *thenStmt;        // IfElse
+    };
+    struct PendingOp {
+        BinOp op; // unused for an open parenthesis
+        int prec;
+    };
+    std::vector<Frame> open;
+    std::vector<Node*> operands;
+    std::vector<PendingOp> ops;
+    // declarations and variable uses of the current function, handed to
+    // resolveLocals once its body is parsed
+    std::vector<DeclStmt*> decls;
+    std::vector<VarExpr*> uses;
+    static bool binaryOp(TokenKind k, PendingOp &out);
+    void reduce(); // pop the top operator and combine its operands
 };
@@ -0,0 +1,321 @@
+#include "server.h"
+#include "tinycc.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace {
+
+const char OpCompile = 'C';
+const char OpStats = 'S';
+const char OpQuit = 'Q';
+const size_t MaxRequest = 64u << 20; // larger requests are refused; responses may be bigger
+const int IdleTimeoutSec = 5;       // see server.h
+
+bool readAll(int fd, void *buf, size_t n){
+    char *p = static_cast<char*>(buf);
+    while(n > 0){
+        ssize_t r = ::read(fd, p, n);
+        if(r < 0 && errno == EINTR) continue;
+        if(r <= 0) return false;
+        p += r; n -= (size_t)r;
+    }
+    return true;
+}
+
+// reads and discards n bytes
+bool skipAll(int fd, size_t n){
+    char buf[65536];
+    while(n > 0){
+        size_t k = n < sizeof(buf) ? n : sizeof(buf);
+        if(!readAll(fd, buf, k)) return false;
+        n -= k;
+    }
+    return true;
+}
+
+// MSG_NOSIGNAL: a peer that hangs up gives EPIPE here rather than killing
+// the process with SIGPIPE
+bool writeAll(int fd, const void *buf, size_t n){
+    const char *p = static_cast<const char*>(buf);
+    while(n > 0){
+        ssize_t r = ::send(fd, p, n, MSG_NOSIGNAL);
+        if(r < 0 && errno == EINTR) continue;
+        if(r <= 0) return false;
+        p += r; n -= (size_t)r;
+    }
+    return true;
+}
+
+void putU32(std::string &out, uint32_t v){
+    for(int k = 0; k < 4; k++) out.push_back((char)((v >> (8*k)) & 0xff));
+}
+
+bool readU32(int fd, uint32_t &v){
+    unsigned char b[4];
+    if(!readAll(fd, b, 4)) return false;
+    v = (uint32_t)b[0] | ((uint32_t)b[1] << 8) | ((uint32_t)b[2] << 16) | ((uint32_t)b[3] << 24);
+    return true;
+}
+
+bool readBlock(int fd, std::string &s){
+    uint32_t len;
+    if(!readU32(fd, len)) return false;
+    s.resize(len);
+    return len == 0 || readAll(fd, &s[0], len);
+}
+
+// frame a response: status, payload, diagnostics; blocks must fit the u32
+// length, which callers check
+bool sendResponse(int fd, char status, const std::string &payload, const std::string &diags){
+    std::string head(1, status);
+    putU32(head, (uint32_t)payload.size());
+    std::string tail;
+    putU32(tail, (uint32_t)diags.size());
+    tail += diags;
+    // the payload can be large; send it without copying
+    return writeAll(fd, head.data(), head.size()) && writeAll(fd, payload.data(), payload.size())
+           && writeAll(fd, tail.data(), tail.size());
+}
+
+struct ServerStats {
+    static const size_t MaxSamples = 100000;
+    std::vector<double> latencyUs; // most recent compile requests, used as a ring
+    size_t requests = 0, failures = 0;
+
+    void record(double us, bool ok){
+        if(latencyUs.size() < MaxSamples) latencyUs.push_back(us);
+        else latencyUs[requests % MaxSamples] = us;
+        requests++;
+        if(!ok) failures++;
+    }
+
+    std::string report(const CompileContext &ctx) const {
+        const FunctionCache &cache = ctx.functions;
+        std::ostringstream out;
+        out << "requests: " << requests << " (" << failures << " failed)\n";
+        if(!latencyUs.empty()){
+            std::vector<double> v = latencyUs;
+            std::sort(v.begin(), v.end());
+            // nearest rank: the smallest sample with at least p of all samples at or below it
+            auto pct = [&](double p){
+                size_t rank = (size_t)std::ceil(p * v.size());
+                return v[rank > 0 ? rank - 1 : 0];
+            };
+            out << "latency us: p50 " << pct(0.50) << "  p90 " << pct(0.90)
+                << "  p99 " << pct(0.99) << "  max " << v.back() << "\n";
+        }
+        out << "function cache: " << cache.entries.size() << " entries (" << cache.bytes << " bytes), "
+            << cache.hits << " hits, " << cache.misses << " misses\n";
+        out << "node arena: " << ctx.nodes.capacity() << " bytes kept for reuse\n";
+        return out.str();
+    }
+};
+
+// uid of the process at the other end of a connected socket, or -1
+long peerUid(int fd){
+    ucred cred;
+    socklen_t len = sizeof(cred);
+    if(::getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0) return -1;
+    return (long)cred.uid;
+}
+
+bool makeAddr(const std::string &path, sockaddr_un &addr){
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if(path.size() >= sizeof(addr.sun_path)){
+        std::cerr << "Socket path too long (" << path.size() << " bytes, limit "
+                  << sizeof(addr.sun_path) - 1 << "): " << path << "\n";
+        return false;
+    }
+    std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    return true;
+}
+
+// serves one connection until EOF; returns false once a quit was requested
+bool serveConnection(int fd, CompileContext &ctx, ServerStats &stats){
+    CompileOptions opts;
+    opts.context = &ctx;
+    while(true){
+        char op;
+        uint32_t len;
+        if(!readAll(fd, &op, 1) || !readU32(fd, len)) return true;
+        auto t0 = std::chrono::steady_clock::now();
+        auto elapsedUs = [&]{ return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - t0).count(); };
+        if(len > MaxRequest){
+            // read past the payload so the client sees the error (closing
+            // with unread data would reset the connection) and can go on
+            bool drained = skipAll(fd, len);
+            bool sent = drained && sendResponse(fd, 1, "", "0: request too large (" + std::to_string(len)
+                                                + " bytes, limit " + std::to_string(MaxRequest) + ")\n");
+            if(op == OpCompile) stats.record(elapsedUs(), false);
+            if(!sent) return true;
+            continue;
+        }
+        std::string payload(len, '\0');
+        if(len > 0 && !readAll(fd, &payload[0], len)) return true;
+        if(op == OpCompile){
+            CompileResult res = compile(payload, opts);
+            if(res.ok && res.output.size() > UINT32_MAX){
+                res.ok = false;
+                res.output.clear();
+                res.diagnostics.push_back(Diagnostic{0, "output too large for the compile server"});
+            }
+            std::string diags;
+            for(auto &d : res.diagnostics) diags += std::to_string(d.line) + ": " + d.message + "\n";
+            bool sent = sendResponse(fd, res.ok ? 0 : 1, res.output, diags);
+            stats.record(elapsedUs(), res.ok && sent);
+            if(!sent) return true;
+        } else if(op == OpStats){
+            if(!sendResponse(fd, 0, stats.report(ctx), "")) return true;
+        } else if(op == OpQuit){
+            sendResponse(fd, 0, "", "");
+            return false;
+        } else {
+            sendResponse(fd, 1, "", "0: unknown request\n");
+            return true;
+        }
+    }
+}
+
+} // namespace
+
+std::string defaultSocketPath(){
+    if(const char *env = std::getenv("TINYCC_SOCKET")) if(*env) return env;
+    if(const char *run = std::getenv("XDG_RUNTIME_DIR")) if(*run) return std::string(run) + "/tinycc.sock";
+    // no per-user runtime dir: use a private directory under /tmp, and
+    // refuse one that someone else created first
+    std::string dir = "/tmp/tinycc-" + std::to_string(getuid());
+    if(::mkdir(dir.c_str(), 0700) < 0 && errno != EEXIST){
+        std::perror(dir.c_str());
+        return "";
+    }
+    struct stat st;
+    if(::lstat(dir.c_str(), &st) < 0 || !S_ISDIR(st.st_mode) || st.st_uid != getuid() || (st.st_mode & 077)){
+        std::cerr << "Refusing to use " << dir << ": not a private directory owned by this user\n";
+        return "";
+    }
+    return dir + "/tinycc.sock";
+}
+
+int runServer(const std::string &socketPath){
+    std::signal(SIGPIPE, SIG_IGN);
+    sockaddr_un addr;
+    if(!makeAddr(socketPath, addr)) return 1;
+    int lfd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if(lfd < 0){ std::perror("socket"); return 1; }
+    // remove a stale socket from a previous run, but only our own
+    struct stat st;
+    if(::lstat(socketPath.c_str(), &st) == 0){
+        if(!S_ISSOCK(st.st_mode) || st.st_uid != getuid()){
+            std::cerr << "Refusing to replace " << socketPath << ": not a socket owned by this user\n";
+            ::close(lfd);
+            return 1;
+        }
+        ::unlink(socketPath.c_str());
+    }
+    if(::bind(lfd, (sockaddr*)&addr, sizeof(addr)) < 0 || ::listen(lfd, 64) < 0){
+        std::perror("bind/listen");
+        ::close(lfd);
+        return 1;
+    }
+    std::cerr << "tinycc: listening on " << socketPath << "\n";
+
+    CompileContext ctx;
+    ServerStats stats;
+    bool running = true;
+    while(running){
+        int fd = ::accept(lfd, nullptr, nullptr);
+        if(fd < 0){
+            if(errno == EINTR) continue;
+            std::perror("accept");
+            break;
+        }
+        // a stalled client would block everyone else; drop it when idle
+        timeval tv{IdleTimeoutSec, 0};
+        ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        ::setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+        // only serve our own user, even if the socket was made reachable
+        if(peerUid(fd) == (long)getuid()) running = serveConnection(fd, ctx, stats);
+        ::close(fd);
+    }
+    ::close(lfd);
+    ::unlink(socketPath.c_str());
+    std::cerr << stats.report(ctx);
+    return 0;
+}
+
+int runClient(const std::string &socketPath, char op, const std::string &inFile){
+    std::string src;
+    if(op == OpCompile){
+        std::ifstream in(inFile);
+        if(!in){ std::cerr << "Cannot open file\n"; return 1; }
+        src.assign((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        if(src.size() > MaxRequest){
+            std::cerr << "Source too large for the compile server (" << src.size() << " bytes, limit "
+                      << MaxRequest << "); compile it without --client\n";
+            return 1;
+        }
+    }
+
+    sockaddr_un addr;
+    if(!makeAddr(socketPath, addr)) return 1;
+    int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0){ std::perror("socket"); return 1; }
+    if(::connect(fd, (sockaddr*)&addr, sizeof(addr)) < 0){
+        std::cerr << "Cannot connect to compile server at " << socketPath << "\n";
+        ::close(fd);
+        return 1;
+    }
+    // whoever owns the socket gets our source and supplies our output
+    if(peerUid(fd) != (long)getuid()){
+        std::cerr << "Compile server at " << socketPath << " is run by another user; refusing\n";
+        ::close(fd);
+        return 1;
+    }
+    std::string req(1, op);
+    putU32(req, (uint32_t)src.size());
+    req += src;
+    char status;
+    std::string payload, diags;
+    // even if the server stopped reading, it may have sent an error first
+    writeAll(fd, req.data(), req.size());
+    bool ok = readAll(fd, &status, 1) && readBlock(fd, payload) && readBlock(fd, diags);
+    ::close(fd);
+    if(!ok){ std::cerr << "Compile server closed the connection\n"; return 1; }
+
+    if(status != 0){
+        std::istringstream lines(diags);
+        std::string l;
+        while(std::getline(lines, l)){
+            // strip the "line: " prefix to match a local run's output
+            size_t colon = l.find(": ");
+            std::cerr << "Error: " << (colon == std::string::npos ? l : l.substr(colon + 2)) << "\n";
+        }
+        return 1;
+    }
+    if(op != OpCompile){
+        std::cout << payload;
+        return 0;
+    }
+    std::string outAsm = inFile + ".s";
+    std::ofstream out(outAsm);
+    out << payload;
+    out.close();
+    std::cout << "Assembly written to " << outAsm << "\n";
+    std::cout << "Now assemble & link with: gcc -no-pie -o prog " << outAsm << "\n";
+    return 0;
+}
@@ -0,0 +1,32 @@
+#pragma once
+#include <string>
+
+// Compile server over a Unix domain socket (`tinycc --daemon`) and the thin
+// client used in place of a full compiler run (`tinycc --client`).
+//
+// Every message is framed as
+//     u8 op | u32 length (little endian) | payload
+// Requests:  'C' compile (payload = source text), 'S' stats, 'Q' shut down.
+// Responses: op is a status byte (0 = ok, 1 = error); payload is the
+// assembly (or the stats report), followed by a second u32-length-prefixed
+// block with diagnostics, one "line: message" per line. Requests over 64MB
+// are skipped and answered with an error; responses are only limited by the
+// u32 length.
+//
+// A connection may carry any number of requests. The server keeps one
+// CompileContext alive across all of them, so token buffers, the AST
+// arena's blocks and the per-function code cache stay warm. That context is
+// not thread-safe, so connections are served one at a time; instead, any
+// connection that sends or accepts no data for 5 seconds
+// (SO_RCVTIMEO/SO_SNDTIMEO) is dropped, so a stalled client holds up the
+// others for at most that long.
+
+// $TINYCC_SOCKET, else $XDG_RUNTIME_DIR/tinycc.sock, else a socket in a
+// 0700 directory /tmp/tinycc-<uid>. Returns "" (after printing why) if that
+// directory exists but is not private to this user. Both ends also check
+// the peer's uid (SO_PEERCRED) and talk only to their own user.
+std::string defaultSocketPath();
+int runServer(const std::string &socketPath);
+// Sends one request and returns the process exit status. For 'C' the
+// assembly is written to out (or diagnostics printed) like a normal run.
+int runClient(const std::string &socketPath, char op, const std::string &inFile);
@@ -0,0 +1,66 @@
+#include "tinycc.h"
+#include "error.h"
+#include "parser.h"
+#include "codegen.h"
+#include "bytecode.h"
+#include <chrono>
+
+static Program parseSource(std::string_view source, const CompileOptions &opts, CompileContext &ctx, Arena &arena){
+    Lexer lx(source);
+    lx.tokenize(ctx.tokens);
+    Parser p(ctx.tokens, arena, opts.maxDepth);
+    return p.parse();
+}
+
+static void addDiagnostic(std::vector<Diagnostic> &diags){
+    try {
+        throw;
+    } catch(CompileError &e){
+        diags.push_back(Diagnostic{e.line, e.what()});
+    } catch(std::exception &e){
+        diags.push_back(Diagnostic{0, e.what()});
+    }
+}
+
+CompileResult compile(std::string_view source, const CompileOptions &opts){
+    CompileResult res;
+    CompileContext local;
+    CompileContext &ctx = opts.context ? *opts.context : local;
+    Arena &arena = opts.arena ? *opts.arena : ctx.nodes;
+    try {
+        Program prog = parseSource(source, opts, ctx, arena);
+        // only a caller-provided context outlives the call, so only then is caching worthwhile
+        CodeGen cg(prog, opts.context ? &ctx.functions : nullptr);
+        res.output = cg.generate();
+        res.ok = true;
+    } catch(std::exception &){
+        addDiagnostic(res.diagnostics);
+    }
+    // the buffer and the tree view the caller's source; don't leave them dangling
+    ctx.tokens.src = std::string_view();
+    arena.reset();
+    return res;
+}
+
+RunResult run(std::string_view source, const CompileOptions &opts){
+    RunResult res;
+    CompileContext local;
+    CompileContext &ctx = opts.context ? *opts.context : local;
+    Arena &arena = opts.arena ? *opts.arena : ctx.nodes;
+    try {
+        Program prog = parseSource(source, opts, ctx, arena);
+        BytecodeGen bg(prog);
+        BytecodeProgram bc = bg.generate();
+        const BytecodeFunction *mainFn = bc.find("main");
+        if(!mainFn) throw CompileError(0, "no main function");
+        auto t0 = std::chrono::steady_clock::now();
+        res.value = runBytecode(*mainFn, res.steps, opts.maxSteps);
+        res.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+        res.ok = true;
+    } catch(std::exception &){
+        addDiagnostic(res.diagnostics);
+    }
+    ctx.tokens.src = std::string_view();
+    arena.reset();
+    return res;
+}
@@ -0,0 +1,61 @@
+#pragma once
+// Embeddable compiler API (libtinycc). compile() has no global state and is
+// safe to call from several threads at once, as long as each thread uses its
+// own CompileContext (or none).
+#include "arena.h"
+#include "lexer.h"
+#include "codegen.h"
+#include "parser.h"
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+struct Diagnostic {
+    int line; // 0 if unknown
+    std::string message;
+};
+
+// Scratch storage that outlives a single compile() call. A long-running
+// caller keeps one per worker thread and passes it in with every request so
+// buffers are reused instead of reallocated. Never share one between
+// concurrent calls.
+struct CompileContext {
+    TokenBuffer tokens;
+    Arena nodes; // AST storage, reset after every call but its blocks kept
+    FunctionCache functions; // generated code of previously seen functions
+};
+
+struct CompileOptions {
+    CompileContext *context = nullptr; // optional, see above
+    // Where AST nodes are allocated; defaults to the context's arena (or a
+    // call-local one). Reset before the call returns, keeping its blocks.
+    Arena *arena = nullptr;
+    size_t maxDepth = Parser::DefaultMaxDepth; // statement/expression nesting limit
+    // run() only: instructions to execute before giving up with an error,
+    // so a program that never terminates cannot hang the caller
+    uint64_t maxSteps = UINT64_MAX;
+};
+
+struct CompileResult {
+    bool ok = false;
+    std::string output; // assembly text, empty on failure
+    std::vector<Diagnostic> diagnostics;
+};
+
+struct RunResult {
+    bool ok = false;
+    int value = 0;       // what main returned
+    uint64_t steps = 0;  // bytecode instructions executed
+    double seconds = 0;  // time spent in the interpreter
+    std::vector<Diagnostic> diagnostics;
+};
+
+// Compile one translation unit held in memory. Never throws for bad input;
+// errors come back in diagnostics.
+CompileResult compile(std::string_view source, const CompileOptions &opts = CompileOptions());
+
+// Compile to bytecode instead and run main in the interpreter. Runtime traps
+// (e.g. division by zero) and running past opts.maxSteps are reported as
+// diagnostics.
+RunResult run(std::string_view source, const CompileOptions &opts = CompileOptions());